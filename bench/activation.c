@@ -0,0 +1,262 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* Measures cold D-Bus activation of the shim.
+ *
+ * Each round makes sure that no shim is running, then calls
+ * GetUnitFileState and waits for the reply, which makes the bus
+ * activate a fresh instance.  The shim writes the time at which it
+ * reached each phase of its startup to $SHIM_ACTIVATION_TRACE (see
+ * shim_trace() in src/systemd-shim.c), which lets us split the total
+ * into process start, name acquisition and first dispatch.
+ *
+ * All times are CLOCK_MONOTONIC, which is shared between processes.
+ * This is meant to be run against a private bus by run-bench.sh.
+ */
+
+#include <gio/gio.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "stats-print.h"
+
+typedef enum
+{
+  PHASE_EXEC,
+  PHASE_BUS,
+  PHASE_NAME,
+  PHASE_DISPATCH,
+  PHASE_REPLY,
+  PHASE_TOTAL,
+  N_PHASES
+} Phase;
+
+static const gchar * const phase_names[N_PHASES] = {
+  "process start",
+  "bus connection",
+  "name acquisition",
+  "first dispatch",
+  "reply delivery",
+  "total"
+};
+
+static gint iterations = 100;
+static const gchar *unit_name = "suspend.target";
+
+static GOptionEntry options[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of activations (default 100)", "N" },
+  { "unit", 'u', 0, G_OPTION_ARG_STRING, &unit_name, "Unit to query (default suspend.target)", "NAME" },
+  { NULL }
+};
+
+static gboolean
+shim_is_running (GDBusConnection *bus)
+{
+  GVariant *reply;
+  gboolean has_owner;
+
+  reply = g_dbus_connection_call_sync (bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "NameHasOwner",
+                                       g_variant_new ("(s)", "org.freedesktop.systemd1"),
+                                       G_VARIANT_TYPE ("(b)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+  if (reply == NULL)
+    return FALSE;
+
+  g_variant_get (reply, "(b)", &has_owner);
+  g_variant_unref (reply);
+
+  return has_owner;
+}
+
+static void
+stop_shim (GDBusConnection *bus)
+{
+  GVariant *reply;
+  guint32 pid;
+
+  reply = g_dbus_connection_call_sync (bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "GetConnectionUnixProcessID",
+                                       g_variant_new ("(s)", "org.freedesktop.systemd1"),
+                                       G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+  if (reply == NULL)
+    return;
+
+  g_variant_get (reply, "(u)", &pid);
+  g_variant_unref (reply);
+
+  kill (pid, SIGTERM);
+
+  while (shim_is_running (bus))
+    g_usleep (1000);
+}
+
+/* Returns FALSE if the trace is missing or incomplete */
+static gboolean
+read_trace (const gchar *filename,
+            gint64       times[N_PHASES])
+{
+  static const gchar * const keys[] = {
+    "main", "bus-acquired", "name-acquired", "dispatch-start", "dispatch-end"
+  };
+  gchar *contents;
+  gchar **lines;
+  guint found = 0;
+  guint i, j;
+
+  if (!g_file_get_contents (filename, &contents, NULL, NULL))
+    return FALSE;
+
+  lines = g_strsplit (contents, "\n", 0);
+  for (i = 0; lines[i]; i++)
+    {
+      gchar *value = strchr (lines[i], ' ');
+
+      if (value == NULL)
+        continue;
+
+      *value++ = '\0';
+
+      for (j = 0; j < G_N_ELEMENTS (keys); j++)
+        if (g_str_equal (lines[i], keys[j]))
+          {
+            times[j] = g_ascii_strtoll (value, NULL, 10);
+            found |= 1u << j;
+          }
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return found == (1u << G_N_ELEMENTS (keys)) - 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GDBusConnection *bus;
+  const gchar *trace_file;
+  GError *error = NULL;
+  GArray *samples[N_PHASES];
+  gint i;
+
+  context = g_option_context_new ("- measure D-Bus activation of systemd-shim");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  trace_file = g_getenv ("SHIM_ACTIVATION_TRACE");
+  if (trace_file == NULL)
+    {
+      g_printerr ("SHIM_ACTIVATION_TRACE must be set\n");
+      return 2;
+    }
+
+  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+  if (bus == NULL)
+    {
+      g_printerr ("Unable to connect to the bus: %s\n", error->message);
+      return 1;
+    }
+
+  for (i = 0; i < N_PHASES; i++)
+    samples[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  for (i = 0; i < iterations; i++)
+    {
+      gint64 trace[N_PHASES];
+      gint64 start, end, value;
+      GVariant *reply;
+      gint j;
+
+      stop_shim (bus);
+      unlink (trace_file);
+
+      start = g_get_monotonic_time ();
+      reply = g_dbus_connection_call_sync (bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                                           "org.freedesktop.systemd1.Manager", "GetUnitFileState",
+                                           g_variant_new ("(s)", unit_name), G_VARIANT_TYPE ("(s)"),
+                                           G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+      end = g_get_monotonic_time ();
+
+      if (reply == NULL)
+        {
+          g_printerr ("Activation %d failed: %s\n", i, error->message);
+          return 1;
+        }
+      g_variant_unref (reply);
+
+      /* The reply can overtake the shim writing its trace, since GDBus
+       * sends it from its own thread.  The trace file is replaced
+       * atomically, so just wait for it to show up.
+       */
+      for (j = 0; j < 1000 && !read_trace (trace_file, trace); j++)
+        g_usleep (1000);
+
+      if (j == 1000)
+        {
+          g_printerr ("Activation %d left no trace in %s\n", i, trace_file);
+          return 1;
+        }
+
+      /* trace[] holds main, bus-acquired, name-acquired, dispatch-start
+       * and dispatch-end, in that order.
+       */
+      for (j = 0; j < N_PHASES; j++)
+        {
+          switch (j)
+            {
+            case PHASE_EXEC:
+              value = trace[0] - start;
+              break;
+            case PHASE_BUS:
+            case PHASE_NAME:
+              value = trace[j] - trace[j - 1];
+              break;
+            case PHASE_DISPATCH:
+              value = trace[4] - trace[2];
+              break;
+            case PHASE_REPLY:
+              value = end - trace[4];
+              break;
+            default:
+              value = end - start;
+              break;
+            }
+
+          g_array_append_val (samples[j], value);
+        }
+    }
+
+  stop_shim (bus);
+
+  g_print ("%d activations of org.freedesktop.systemd1 (GetUnitFileState %s)\n\n", iterations, unit_name);
+  stats_print_header ("usec");
+  for (i = 0; i < N_PHASES; i++)
+    stats_print_row (phase_names[i], samples[i]);
+
+  return 0;
+}
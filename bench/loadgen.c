@@ -0,0 +1,403 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* Puts concurrent load on the Manager interface.
+ *
+ * Opens a number of separate client connections and keeps issuing a
+ * weighted mix of calls on them: GetUnitFileState, Get Virtualization,
+ * StartUnit and GetUnitFileState for a unit that does not exist.  The
+ * shim is expected to run with SYSTEMD_SHIM_DRY_RUN set so that
+ * StartUnit does not actually do anything.
+ *
+ * With --rate the calls are issued open-loop at a fixed total rate and
+ * latency is counted from the time each call was due, so a stalled
+ * shim shows up in the numbers instead of slowing the generator down.
+ * Without it every connection keeps one call in flight (closed loop)
+ * and the result is the maximum throughput.
+ */
+
+#include <gio/gio.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats-print.h"
+
+typedef enum
+{
+  OP_STATE,
+  OP_VIRT,
+  OP_START,
+  OP_UNKNOWN,
+  N_OPS
+} Op;
+
+static const gchar * const op_names[N_OPS] = { "state", "virt", "start", "unknown" };
+
+typedef struct
+{
+  GDBusConnection *connection;
+  guint in_flight;
+} Client;
+
+typedef struct
+{
+  Client *client;
+  Op op;
+  gint64 due;
+} Call;
+
+static gint n_clients = 8;
+static gint rate;
+static gint duration = 10;
+static const gchar *mix = "state=60,virt=20,start=10,unknown=10";
+static const gchar *unit_name = "suspend.target";
+
+static GOptionEntry options[] = {
+  { "connections", 'c', 0, G_OPTION_ARG_INT, &n_clients, "Number of client connections (default 8)", "N" },
+  { "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Total calls per second (default: as fast as possible)", "N" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to run for (default 10)", "SECS" },
+  { "mix", 'm', 0, G_OPTION_ARG_STRING, &mix, "Weights of the calls (default state=60,virt=20,start=10,unknown=10)", "MIX" },
+  { "unit", 'u', 0, G_OPTION_ARG_STRING, &unit_name, "Unit to query and start (default suspend.target)", "NAME" },
+  { NULL }
+};
+
+static guint op_weights[N_OPS];
+static guint total_weight;
+
+static Client *clients;
+static guint64 n_issued;
+static gint64 start_time;
+static gint64 end_time;
+static gboolean stopping;
+static GMainLoop *loop;
+
+static GArray *latencies[N_OPS];
+static guint errors[N_OPS];
+
+static gboolean
+parse_mix (const gchar  *string,
+           GError      **error)
+{
+  gchar **items;
+  guint i;
+  Op op;
+
+  items = g_strsplit (string, ",", 0);
+  for (i = 0; items[i]; i++)
+    {
+      gchar *value = strchr (items[i], '=');
+      gchar *end;
+      guint64 weight;
+
+      if (value)
+        *value++ = '\0';
+
+      for (op = 0; op < N_OPS; op++)
+        if (g_str_equal (items[i], op_names[op]))
+          break;
+
+      if (value == NULL || op == N_OPS ||
+          (weight = g_ascii_strtoull (value, &end, 10), *end != '\0') || weight > 1000000)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Invalid mix entry '%s' (expected e.g. state=60)", items[i]);
+          g_strfreev (items);
+          return FALSE;
+        }
+
+      op_weights[op] = weight;
+    }
+  g_strfreev (items);
+
+  total_weight = 0;
+  for (op = 0; op < N_OPS; op++)
+    total_weight += op_weights[op];
+
+  if (total_weight == 0)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "The mix is empty");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static Op
+pick_op (void)
+{
+  guint32 n;
+  Op op;
+
+  n = g_random_int_range (0, total_weight);
+  for (op = 0; n >= op_weights[op]; op++)
+    n -= op_weights[op];
+
+  return op;
+}
+
+static void issue_call (Client *client, gint64 due);
+
+static void
+call_done (GObject      *source,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  Call *call = user_data;
+  GError *error = NULL;
+  GVariant *reply;
+  gint64 latency;
+
+  reply = g_dbus_connection_call_finish (call->client->connection, result, &error);
+  latency = g_get_monotonic_time () - call->due;
+
+  /* The unknown unit is supposed to fail, and nothing else is */
+  if (call->op == OP_UNKNOWN)
+    {
+      if (reply || !g_dbus_error_is_remote_error (error))
+        errors[call->op]++;
+    }
+  else if (reply == NULL)
+    {
+      if (errors[call->op]++ == 0)
+        g_printerr ("%s: %s\n", op_names[call->op], error->message);
+    }
+
+  g_array_append_val (latencies[call->op], latency);
+
+  if (reply)
+    g_variant_unref (reply);
+  g_clear_error (&error);
+
+  call->client->in_flight--;
+
+  if (rate == 0 && !stopping)
+    issue_call (call->client, g_get_monotonic_time ());
+
+  else if (stopping)
+    {
+      gint i;
+
+      for (i = 0; i < n_clients; i++)
+        if (clients[i].in_flight)
+          break;
+
+      if (i == n_clients)
+        g_main_loop_quit (loop);
+    }
+
+  g_slice_free (Call, call);
+}
+
+static void
+issue_call (Client *client,
+            gint64  due)
+{
+  const gchar *interface = "org.freedesktop.systemd1.Manager";
+  const GVariantType *reply_type;
+  const gchar *method;
+  GVariant *parameters;
+  Call *call;
+
+  call = g_slice_new (Call);
+  call->client = client;
+  call->op = pick_op ();
+  call->due = due;
+
+  switch (call->op)
+    {
+    case OP_STATE:
+      method = "GetUnitFileState";
+      parameters = g_variant_new ("(s)", unit_name);
+      reply_type = G_VARIANT_TYPE ("(s)");
+      break;
+
+    case OP_VIRT:
+      interface = "org.freedesktop.DBus.Properties";
+      method = "Get";
+      parameters = g_variant_new ("(ss)", "org.freedesktop.systemd1.Manager", "Virtualization");
+      reply_type = G_VARIANT_TYPE ("(v)");
+      break;
+
+    case OP_START:
+      method = "StartUnit";
+      parameters = g_variant_new ("(ss)", unit_name, "replace");
+      reply_type = G_VARIANT_TYPE ("(o)");
+      break;
+
+    default:
+      method = "GetUnitFileState";
+      parameters = g_variant_new ("(s)", "no-such-unit.service");
+      reply_type = G_VARIANT_TYPE ("(s)");
+      break;
+    }
+
+  client->in_flight++;
+  n_issued++;
+
+  g_dbus_connection_call (client->connection, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+                          interface, method, parameters, reply_type, G_DBUS_CALL_FLAGS_NONE, -1,
+                          NULL, call_done, call);
+}
+
+static void
+stop (void)
+{
+  gint i;
+
+  stopping = TRUE;
+  end_time = g_get_monotonic_time ();
+
+  for (i = 0; i < n_clients; i++)
+    if (clients[i].in_flight)
+      return;
+
+  g_main_loop_quit (loop);
+}
+
+/* Open loop: issue whatever has become due since the last tick */
+static gboolean
+rate_tick (gpointer user_data)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint64 due;
+
+  if (now - start_time >= (gint64) duration * G_USEC_PER_SEC)
+    {
+      stop ();
+      return FALSE;
+    }
+
+  due = (now - start_time) * rate / G_USEC_PER_SEC;
+
+  while (n_issued < due)
+    issue_call (&clients[n_issued % n_clients], start_time + (gint64) (n_issued * G_USEC_PER_SEC / rate));
+
+  return TRUE;
+}
+
+static gboolean
+duration_elapsed (gpointer user_data)
+{
+  stop ();
+
+  return FALSE;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GVariant *reply;
+  gdouble elapsed;
+  guint64 total = 0;
+  gchar *address;
+  gint i;
+
+  context = g_option_context_new ("- load test the systemd-shim Manager interface");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error) || !parse_mix (mix, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (n_clients < 1 || duration < 1 || rate < 0)
+    {
+      g_printerr ("--connections and --duration must be positive, --rate must not be negative\n");
+      return 2;
+    }
+
+  address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+  if (address == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  clients = g_new0 (Client, n_clients);
+  for (i = 0; i < n_clients; i++)
+    {
+      clients[i].connection =
+        g_dbus_connection_new_for_address_sync (address,
+                                                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                NULL, NULL, &error);
+      if (clients[i].connection == NULL)
+        {
+          g_printerr ("Unable to connect to the bus: %s\n", error->message);
+          return 1;
+        }
+    }
+  g_free (address);
+
+  /* Make sure the shim is running, so that activation does not end up
+   * in the numbers.
+   */
+  reply = g_dbus_connection_call_sync (clients[0].connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "StartServiceByName",
+                                       g_variant_new ("(su)", "org.freedesktop.systemd1", 0),
+                                       G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  if (reply == NULL)
+    {
+      g_printerr ("Unable to start the shim: %s\n", error->message);
+      return 1;
+    }
+  g_variant_unref (reply);
+
+  for (i = 0; i < N_OPS; i++)
+    latencies[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  loop = g_main_loop_new (NULL, FALSE);
+  start_time = g_get_monotonic_time ();
+
+  if (rate)
+    g_timeout_add (1, rate_tick, NULL);
+  else
+    {
+      for (i = 0; i < n_clients; i++)
+        issue_call (&clients[i], start_time);
+
+      g_timeout_add (duration * 1000, duration_elapsed, NULL);
+    }
+
+  g_main_loop_run (loop);
+
+  elapsed = (gdouble) (end_time - start_time) / G_USEC_PER_SEC;
+
+  g_print ("%d connections, %s, %.1f s\n\n", n_clients,
+           rate ? "open loop" : "closed loop", elapsed);
+
+  g_print ("%-20s %9s %9s %9s\n", "", "calls", "errors", "calls/s");
+  for (i = 0; i < N_OPS; i++)
+    {
+      g_print ("%-20s %9u %9u %9.0f\n", op_names[i], latencies[i]->len, errors[i], latencies[i]->len / elapsed);
+      total += latencies[i]->len;
+    }
+  g_print ("%-20s %9" G_GUINT64_FORMAT " %9s %9.0f\n\n", "total", total, "", total / elapsed);
+
+  stats_print_header ("usec");
+  for (i = 0; i < N_OPS; i++)
+    if (op_weights[i])
+      stats_print_row (op_names[i], latencies[i]);
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Runs one of the benchmark programs against a private bus.
+#
+# usage: run-bench.sh SHIM BENCH [BENCH-OPTIONS...]
+#
+# The bus is set up like the system bus as far as the shim is concerned
+# (DBUS_SYSTEM_BUS_ADDRESS points at it) but activates services itself
+# rather than through the setuid helper, so this does not need root.
+# The shim runs in dry-run mode and leaves the system alone.
+
+set -e
+
+shim="$1"
+bench="$2"
+shift 2
+
+tmpdir=$(mktemp -d)
+bus_pid=
+trap 'test -n "$bus_pid" && kill $bus_pid; rm -rf "$tmpdir"' EXIT
+
+mkdir "$tmpdir/services"
+cat > "$tmpdir/services/org.freedesktop.systemd1.service" <<END
+[D-BUS Service]
+Name=org.freedesktop.systemd1
+Exec=$shim
+END
+
+cat > "$tmpdir/bus.conf" <<END
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-BUS Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <listen>unix:path=$tmpdir/bus</listen>
+  <auth>EXTERNAL</auth>
+  <servicedir>$tmpdir/services</servicedir>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*"/>
+    <allow receive_sender="*"/>
+  </policy>
+</busconfig>
+END
+
+DBUS_SYSTEM_BUS_ADDRESS="unix:path=$tmpdir/bus"
+SHIM_ACTIVATION_TRACE="$tmpdir/trace"
+SYSTEMD_SHIM_DRY_RUN=1
+export DBUS_SYSTEM_BUS_ADDRESS SHIM_ACTIVATION_TRACE SYSTEMD_SHIM_DRY_RUN
+
+bus_pid=$(${DBUS_DAEMON:-dbus-daemon} --config-file="$tmpdir/bus.conf" --fork --print-pid)
+
+"$bench" "$@"
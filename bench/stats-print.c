@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "stats-print.h"
+
+static gint
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted array */
+static gint64
+percentile (GArray *sorted,
+            gdouble p)
+{
+  guint rank;
+
+  rank = (guint) (p / 100.0 * sorted->len + 0.999999);
+  if (rank == 0)
+    rank = 1;
+  if (rank > sorted->len)
+    rank = sorted->len;
+
+  return g_array_index (sorted, gint64, rank - 1);
+}
+
+void
+stats_print_header (const gchar *unit)
+{
+  g_print ("%-20s %9s %9s %9s %9s %9s %9s   (%s)\n",
+           "", "min", "p50", "p90", "p99", "p99.9", "max", unit);
+}
+
+void
+stats_print_row (const gchar *name,
+                 GArray      *samples)
+{
+  if (samples->len == 0)
+    {
+      g_print ("%-20s %9s\n", name, "-");
+      return;
+    }
+
+  g_array_sort (samples, compare_samples);
+
+  g_print ("%-20s %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT
+           " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT "\n",
+           name,
+           g_array_index (samples, gint64, 0),
+           percentile (samples, 50), percentile (samples, 90),
+           percentile (samples, 99), percentile (samples, 99.9),
+           g_array_index (samples, gint64, samples->len - 1));
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _stats_print_h_
+#define _stats_print_h_
+
+#include <glib.h>
+
+/* Prints a table of latency distributions.  Samples are gint64 in
+ * whatever unit the header names; stats_print_row() sorts the array in
+ * place.
+ */
+void stats_print_header (const gchar *unit);
+void stats_print_row (const gchar *name, GArray *samples);
+
+#endif /* _stats_print_h_ */
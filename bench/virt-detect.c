@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* Microbenchmark for virtualization detection.
+ *
+ * Runs detect_virtualization_at() against each recorded tree in a
+ * fixture directory (by default virt-fixtures/ next to this file) and
+ * reports how long one uncached detection takes.  Each fixture has an
+ * 'expected' file saying what should be detected ("none", "vm kvm",
+ * "container lxc", ...); a mismatch makes the run fail, so this also
+ * checks the detection tables.
+ *
+ * CPUID is not looked at for fixtures, so the numbers are the cost of
+ * the file based probes, which is what dominates on a real system.
+ */
+
+#include <gio/gio.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "virt.h"
+#include "stats-print.h"
+
+static gint iterations = 10000;
+
+static GOptionEntry options[] = {
+  { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Detections per fixture (default 10000)", "N" },
+  { NULL }
+};
+
+static gchar *
+describe (Virtualization  virt,
+          const gchar    *id)
+{
+  switch ((gint) virt)
+    {
+    case VIRTUALIZATION_NONE:
+      return g_strdup ("none");
+    case VIRTUALIZATION_VM:
+      return g_strdup_printf ("vm %s", id);
+    case VIRTUALIZATION_CONTAINER:
+      return g_strdup_printf ("container %s", id);
+    default:
+      return g_strdup_printf ("error %s", g_strerror (-virt));
+    }
+}
+
+static gboolean
+bench_fixture (const gchar *root,
+               const gchar *name)
+{
+  gchar *expected_file;
+  gchar *expected;
+  gchar *result;
+  const gchar *id = NULL;
+  Virtualization virt;
+  GArray *samples;
+  gboolean ok;
+  gint i;
+
+  expected_file = g_build_filename (root, "expected", NULL);
+  if (!g_file_get_contents (expected_file, &expected, NULL, NULL))
+    {
+      g_printerr ("%s: no 'expected' file\n", name);
+      g_free (expected_file);
+      return FALSE;
+    }
+  g_free (expected_file);
+  g_strstrip (expected);
+
+  virt = detect_virtualization_at (root, &id);
+  result = describe (virt, id);
+  ok = g_str_equal (result, expected);
+  if (!ok)
+    g_printerr ("%s: detected '%s', expected '%s'\n", name, result, expected);
+
+  samples = g_array_sized_new (FALSE, FALSE, sizeof (gint64), iterations);
+  for (i = 0; i < iterations; i++)
+    {
+      struct timespec start, end;
+      gint64 nsec;
+
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      detect_virtualization_at (root, &id);
+      clock_gettime (CLOCK_MONOTONIC, &end);
+
+      nsec = (end.tv_sec - start.tv_sec) * G_GINT64_CONSTANT (1000000000) + (end.tv_nsec - start.tv_nsec);
+      g_array_append_val (samples, nsec);
+    }
+
+  stats_print_row (name, samples);
+
+  g_array_unref (samples);
+  g_free (expected);
+  g_free (result);
+
+  return ok;
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  const gchar *fixtures;
+  GError *error = NULL;
+  const gchar *name;
+  GPtrArray *names;
+  gboolean ok = TRUE;
+  GDir *dir;
+  guint i;
+
+  context = g_option_context_new ("[FIXTURE-DIR] - benchmark virtualization detection");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  fixtures = argc > 1 ? argv[1] : "virt-fixtures";
+
+  dir = g_dir_open (fixtures, 0, &error);
+  if (dir == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      return 2;
+    }
+
+  names = g_ptr_array_new_with_free_func (g_free);
+  while ((name = g_dir_read_name (dir)))
+    g_ptr_array_add (names, g_strdup (name));
+  g_dir_close (dir);
+
+  g_ptr_array_sort (names, compare_names);
+
+  g_print ("%d uncached detections per fixture\n\n", iterations);
+  stats_print_header ("nsec");
+
+  for (i = 0; i < names->len; i++)
+    {
+      gchar *root;
+
+      root = g_build_filename (fixtures, names->pdata[i], NULL);
+      ok &= bench_fixture (root, names->pdata[i]);
+      g_free (root);
+    }
+
+  g_ptr_array_unref (names);
+
+  return ok ? 0 : 1;
+}
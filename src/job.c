@@ -0,0 +1,500 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "job.h"
+#include "shim.h"
+#include "stats.h"
+#include "probes.h"
+
+/* Jobs are queued per unit and run one at a time, in order.  Jobs for
+ * different units run concurrently.  While it exists, each job is
+ * exported on the bus as /org/freedesktop/systemd1/job/<id>, and its
+ * life cycle is announced with the JobNew and JobRemoved signals.
+ */
+
+#define MANAGER_PATH        "/org/freedesktop/systemd1"
+#define MANAGER_INTERFACE   "org.freedesktop.systemd1.Manager"
+#define JOB_TIMEOUT_SECONDS 90
+
+struct _Job
+{
+  guint32 id;
+  gchar *path;
+  Unit *unit;
+  gchar *unit_name;
+  JobType type;
+
+  gboolean running;
+  gboolean removed;
+  guint registration_id;
+  guint timeout_id;
+  gint64 start_time;
+};
+
+static GDBusConnection *job_connection;
+static GDBusInterfaceInfo *job_interface;
+static GHashTable *job_queues;
+static guint32 last_job_id;
+static guint n_jobs;
+
+static const GDBusErrorEntry job_error_entries[] = {
+  { JOB_ERROR_TRANSACTION_IS_DESTRUCTIVE, "org.freedesktop.systemd1.TransactionIsDestructive" }
+};
+
+static const gchar * const job_mode_names[] = {
+  [JOB_MODE_REPLACE] = "replace",
+  [JOB_MODE_REPLACE_IRREVERSIBLY] = "replace-irreversibly",
+  [JOB_MODE_FAIL] = "fail",
+  [JOB_MODE_IGNORE_DEPENDENCIES] = "ignore-dependencies",
+  [JOB_MODE_IGNORE_REQUIREMENTS] = "ignore-requirements"
+};
+
+GQuark
+job_error_quark (void)
+{
+  static volatile gsize quark;
+
+  g_dbus_error_register_error_domain ("job-error-quark", &quark,
+                                      job_error_entries, G_N_ELEMENTS (job_error_entries));
+
+  return (GQuark) quark;
+}
+
+gboolean
+job_mode_from_string (const gchar  *string,
+                      JobMode      *mode,
+                      GError      **error)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (job_mode_names); i++)
+    if (g_str_equal (string, job_mode_names[i]))
+      {
+        *mode = i;
+        return TRUE;
+      }
+
+  g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Job mode %s invalid", string);
+
+  return FALSE;
+}
+
+static const gchar *
+job_type_to_string (JobType type)
+{
+  return type == JOB_START ? "start" : "stop";
+}
+
+static GQueue *
+job_get_queue (Unit *unit)
+{
+  GQueue *queue;
+
+  if (job_queues == NULL)
+    job_queues = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  queue = g_hash_table_lookup (job_queues, unit);
+
+  if (queue == NULL)
+    {
+      /* Units live for as long as the process, and so do their queues */
+      queue = g_queue_new ();
+      g_hash_table_insert (job_queues, unit, queue);
+    }
+
+  return queue;
+}
+
+/* Takes the job off the bus and tells everybody how it ended.  The job
+ * itself stays around until its unit operation has completed.
+ */
+static void
+job_remove (Job         *job,
+            const gchar *result)
+{
+  if (job->removed)
+    return;
+
+  job->removed = TRUE;
+
+  if (job->timeout_id)
+    {
+      g_source_remove (job->timeout_id);
+      job->timeout_id = 0;
+    }
+
+  g_dbus_connection_unregister_object (job_connection, job->registration_id);
+  g_dbus_connection_emit_signal (job_connection, NULL, MANAGER_PATH, MANAGER_INTERFACE, "JobRemoved",
+                                 g_variant_new ("(uoss)", job->id, job->path, job->unit_name, result), NULL);
+  n_jobs--;
+  shim_jobs_changed ();
+}
+
+static void
+job_free (Job *job)
+{
+  g_queue_remove (job_get_queue (job->unit), job);
+
+  g_object_unref (job->unit);
+  g_free (job->unit_name);
+  g_free (job->path);
+  g_slice_free (Job, job);
+
+  shim_release ();
+}
+
+static void job_run (Job *job);
+
+static void
+job_run_next (Unit *unit)
+{
+  Job *next;
+
+  next = g_queue_peek_head (job_get_queue (unit));
+
+  if (next && !next->running)
+    job_run (next);
+}
+
+static void
+job_unit_done (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  Job *job = user_data;
+  Unit *unit = (Unit *) source;
+  GError *error = NULL;
+  gboolean success;
+
+  if (job->type == JOB_START)
+    success = unit_start_finish (unit, result, &error);
+  else
+    success = unit_stop_finish (unit, result, &error);
+
+  if (job->type == JOB_START)
+    SHIM_PROBE4 (unit__start__return, job->unit_name, job->id, g_get_monotonic_time () - job->start_time, success);
+  else
+    SHIM_PROBE4 (unit__stop__return, job->unit_name, job->id, g_get_monotonic_time () - job->start_time, success);
+
+  stats_record (job->type == JOB_START ? STATS_UNIT_START : STATS_UNIT_STOP,
+                job->unit_name, g_get_monotonic_time () - job->start_time);
+
+  if (!success)
+    {
+      stats_record_error (job->type == JOB_START ? STATS_UNIT_START : STATS_UNIT_STOP, job->unit_name);
+      g_warning ("Job %u (%s %s) failed: %s", job->id, job_type_to_string (job->type),
+                 job->unit_name, error->message);
+      g_error_free (error);
+    }
+
+  job_remove (job, success ? "done" : "failed");
+  job_free (job);
+
+  job_run_next (unit);
+}
+
+static gboolean
+job_timed_out (gpointer user_data)
+{
+  Job *job = user_data;
+
+  /* We can't interrupt the unit, so the next job for it still has to
+   * wait until this one really completes.
+   */
+  job->timeout_id = 0;
+  job_remove (job, "timeout");
+
+  return FALSE;
+}
+
+static void
+job_run (Job *job)
+{
+  job->running = TRUE;
+  job->start_time = g_get_monotonic_time ();
+  job->timeout_id = g_timeout_add_seconds (JOB_TIMEOUT_SECONDS, job_timed_out, job);
+
+  if (job->type == JOB_START)
+    {
+      SHIM_PROBE2 (unit__start__entry, job->unit_name, job->id);
+      unit_start (job->unit, job_unit_done, job);
+    }
+  else
+    {
+      SHIM_PROBE2 (unit__stop__entry, job->unit_name, job->id);
+      unit_stop (job->unit, job_unit_done, job);
+    }
+}
+
+static void
+job_cancel (Job *job)
+{
+  g_return_if_fail (!job->running);
+
+  job_remove (job, "canceled");
+  job_free (job);
+}
+
+static void
+job_method_call (GDBusConnection       *connection,
+                 const gchar           *sender,
+                 const gchar           *object_path,
+                 const gchar           *interface_name,
+                 const gchar           *method_name,
+                 GVariant              *parameters,
+                 GDBusMethodInvocation *invocation,
+                 gpointer               user_data)
+{
+  Job *job = user_data;
+
+  g_assert_cmpstr (method_name, ==, "Cancel");
+
+  if (job->running)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+                                             "Job %u is already running", job->id);
+      return;
+    }
+
+  job_cancel (job);
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static GVariant *
+job_get_property (GDBusConnection  *connection,
+                  const gchar      *sender,
+                  const gchar      *object_path,
+                  const gchar      *interface_name,
+                  const gchar      *property_name,
+                  GError          **error,
+                  gpointer          user_data)
+{
+  Job *job = user_data;
+
+  if (g_str_equal (property_name, "Id"))
+    return g_variant_new_uint32 (job->id);
+
+  else if (g_str_equal (property_name, "Unit"))
+    {
+      GVariant *value;
+      gchar *path;
+
+      path = unit_name_to_path (job->unit_name);
+      value = g_variant_new ("(so)", job->unit_name, path);
+      g_free (path);
+
+      return value;
+    }
+
+  else if (g_str_equal (property_name, "JobType"))
+    return g_variant_new_string (job_type_to_string (job->type));
+
+  else if (g_str_equal (property_name, "State"))
+    return g_variant_new_string (job->running ? "running" : "waiting");
+
+  g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+               "Unknown property: %s", property_name);
+
+  return NULL;
+}
+
+static const GDBusInterfaceVTable job_vtable = {
+  job_method_call,
+  job_get_property
+};
+
+Job *
+job_enqueue (Unit         *unit,
+             const gchar  *unit_name,
+             JobType       type,
+             JobMode       mode,
+             GError      **error)
+{
+  GList *l, *next;
+  GQueue *queue;
+  Job *job;
+
+  g_return_val_if_fail (job_connection != NULL, NULL);
+
+  queue = job_get_queue (unit);
+
+  /* A pending job of the other type for the same unit conflicts with
+   * this one.  'fail' refuses the request; the other modes cancel any
+   * such job that has not started yet.  Running jobs can't be undone.
+   * The shim has no dependencies, so the ignore-* modes are the same
+   * as 'replace'.
+   */
+  for (l = queue->head; l; l = next)
+    {
+      Job *other = l->data;
+
+      next = l->next;
+
+      if (other->type == type || other->removed)
+        continue;
+
+      if (mode == JOB_MODE_FAIL)
+        {
+          g_set_error (error, JOB_ERROR, JOB_ERROR_TRANSACTION_IS_DESTRUCTIVE,
+                       "Transaction is destructive.");
+          return NULL;
+        }
+
+      if (!other->running)
+        job_cancel (other);
+    }
+
+  /* If the last job that is still queued or running for the unit is an
+   * identical request, that job absorbs this one: the caller gets the
+   * same job path and the same JobRemoved.  This is what keeps a burst
+   * of lid-close events from several session agents down to a single
+   * suspend.
+   */
+  for (l = queue->tail; l; l = l->prev)
+    {
+      Job *other = l->data;
+
+      if (other->removed)
+        continue;
+
+      if (other->type == type)
+        return other;
+
+      break;
+    }
+
+  job = g_slice_new0 (Job);
+  job->id = ++last_job_id;
+  job->path = g_strdup_printf (MANAGER_PATH "/job/%u", job->id);
+  job->unit = g_object_ref (unit);
+  job->unit_name = g_strdup (unit_name);
+  job->type = type;
+
+  job->registration_id = g_dbus_connection_register_object (job_connection, job->path, job_interface,
+                                                            &job_vtable, job, NULL, NULL);
+  g_queue_push_tail (queue, job);
+  n_jobs++;
+  shim_hold ();
+
+  g_dbus_connection_emit_signal (job_connection, NULL, MANAGER_PATH, MANAGER_INTERFACE, "JobNew",
+                                 g_variant_new ("(uos)", job->id, job->path, job->unit_name), NULL);
+  shim_jobs_changed ();
+
+  /* Unit operations always complete from a later main loop iteration,
+   * so the caller gets to reply with the job path before JobRemoved.
+   */
+  job_run_next (unit);
+
+  return job;
+}
+
+const gchar *
+job_get_path (Job *job)
+{
+  return job->path;
+}
+
+guint32
+job_get_id (Job *job)
+{
+  return job->id;
+}
+
+const gchar *
+job_get_type_string (Job *job)
+{
+  return job_type_to_string (job->type);
+}
+
+Job *
+job_manager_lookup (guint32 id)
+{
+  GHashTableIter iter;
+  GQueue *queue;
+
+  if (job_queues == NULL)
+    return NULL;
+
+  g_hash_table_iter_init (&iter, job_queues);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &queue))
+    {
+      GList *node;
+
+      for (node = queue->head; node; node = node->next)
+        {
+          Job *job = node->data;
+
+          if (job->id == id && !job->removed)
+            return job;
+        }
+    }
+
+  return NULL;
+}
+
+/* The first job for the unit that is still on the bus, if any */
+Job *
+job_manager_get_unit_job (Unit *unit)
+{
+  GList *node;
+
+  if (job_queues == NULL)
+    return NULL;
+
+  for (node = job_get_queue (unit)->head; node; node = node->next)
+    {
+      Job *job = node->data;
+
+      if (!job->removed)
+        return job;
+    }
+
+  return NULL;
+}
+
+guint
+job_manager_get_n_jobs (void)
+{
+  return n_jobs;
+}
+
+guint32
+job_manager_get_last_id (void)
+{
+  return last_job_id;
+}
+
+/* Used when restoring state from a previous instance, so that job paths
+ * are not reused within one boot.
+ */
+void
+job_manager_set_last_id (guint32 id)
+{
+  g_return_if_fail (n_jobs == 0);
+
+  last_job_id = id;
+}
+
+void
+job_manager_init (GDBusConnection    *connection,
+                  GDBusInterfaceInfo *job_iface)
+{
+  job_connection = g_object_ref (connection);
+  job_interface = g_dbus_interface_info_ref (job_iface);
+}
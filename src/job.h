@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _job_h_
+#define _job_h_
+
+#include "unit.h"
+
+typedef enum
+{
+  JOB_START,
+  JOB_STOP
+} JobType;
+
+typedef enum
+{
+  JOB_MODE_REPLACE,
+  JOB_MODE_REPLACE_IRREVERSIBLY,
+  JOB_MODE_FAIL,
+  JOB_MODE_IGNORE_DEPENDENCIES,
+  JOB_MODE_IGNORE_REQUIREMENTS
+} JobMode;
+
+typedef enum
+{
+  JOB_ERROR_TRANSACTION_IS_DESTRUCTIVE
+} JobError;
+
+#define JOB_ERROR (job_error_quark ())
+GQuark job_error_quark (void);
+
+typedef struct _Job Job;
+
+void job_manager_init (GDBusConnection *connection, GDBusInterfaceInfo *job_iface);
+guint job_manager_get_n_jobs (void);
+guint32 job_manager_get_last_id (void);
+void job_manager_set_last_id (guint32 id);
+
+gboolean job_mode_from_string (const gchar *string, JobMode *mode, GError **error);
+
+Job *job_enqueue (Unit *unit, const gchar *unit_name, JobType type, JobMode mode, GError **error);
+const gchar *job_get_path (Job *job);
+guint32 job_get_id (Job *job);
+const gchar *job_get_type_string (Job *job);
+Job *job_manager_get_unit_job (Unit *unit);
+Job *job_manager_lookup (guint32 id);
+
+#endif /* _job_h_ */
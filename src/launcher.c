@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "launcher.h"
+#include "shim.h"
+#include "stats.h"
+#include "probes.h"
+
+#include <sys/wait.h>
+#include <spawn.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+
+/* Helpers are started directly with posix_spawn(), which uses vfork
+ * semantics, instead of going through /bin/sh or GLib's fork-based
+ * spawning.  They get a fixed minimal environment, /dev/null on the
+ * standard streams and none of our other file descriptors.
+ */
+static const gchar * const helper_environ[] = {
+  "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin",
+  "LANG=C",
+  NULL
+};
+
+typedef struct
+{
+  gchar *command;
+  gint64 start_time;
+} SpawnData;
+
+static void
+spawn_data_free (gpointer data)
+{
+  SpawnData *spawn_data = data;
+
+  g_free (spawn_data->command);
+  g_slice_free (SpawnData, spawn_data);
+}
+
+static gint
+launcher_add_close_fds (posix_spawn_file_actions_t *actions)
+{
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+  return posix_spawn_file_actions_addclosefrom_np (actions, 3);
+#else
+  struct dirent *de;
+  DIR *dir;
+  gint r = 0;
+
+  dir = opendir ("/proc/self/fd");
+  if (dir == NULL)
+    return 0;
+
+  while (r == 0 && (de = readdir (dir)))
+    {
+      gint fd;
+
+      if (de->d_name[0] == '.')
+        continue;
+
+      fd = atoi (de->d_name);
+      if (fd > 2 && fd != dirfd (dir))
+        r = posix_spawn_file_actions_addclose (actions, fd);
+    }
+
+  closedir (dir);
+
+  return r;
+#endif
+}
+
+static gint
+launcher_spawn (const gchar * const *argv,
+                pid_t               *pid)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t mask;
+  gint r;
+
+  posix_spawn_file_actions_init (&actions);
+  posix_spawnattr_init (&attr);
+
+  /* Don't let the child inherit our signal mask or dispositions */
+  sigemptyset (&mask);
+  posix_spawnattr_setsigmask (&attr, &mask);
+  sigfillset (&mask);
+  posix_spawnattr_setsigdefault (&attr, &mask);
+  posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  if ((r = posix_spawn_file_actions_addopen (&actions, 0, "/dev/null", O_RDONLY, 0)) != 0 ||
+      (r = posix_spawn_file_actions_addopen (&actions, 1, "/dev/null", O_WRONLY, 0)) != 0 ||
+      (r = posix_spawn_file_actions_adddup2 (&actions, 1, 2)) != 0 ||
+      (r = launcher_add_close_fds (&actions)) != 0)
+    goto out;
+
+  r = posix_spawn (pid, argv[0], &actions, &attr, (gchar * const *) argv, (gchar * const *) helper_environ);
+
+out:
+  posix_spawnattr_destroy (&attr);
+  posix_spawn_file_actions_destroy (&actions);
+
+  return r;
+}
+
+static void
+spawn_helper_exited (GPid     pid,
+                     gint     status,
+                     gpointer user_data)
+{
+  GTask *task = user_data;
+  SpawnData *data = g_task_get_task_data (task);
+
+  g_spawn_close_pid (pid);
+
+  SHIM_PROBE4 (spawn__return, data->command, pid, g_get_monotonic_time () - data->start_time, status);
+  stats_record (STATS_SPAWN, data->command, g_get_monotonic_time () - data->start_time);
+
+  if (WIFEXITED (status) && WEXITSTATUS (status) == 0)
+    {
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  stats_record_error (STATS_SPAWN, data->command);
+
+  if (WIFEXITED (status))
+    g_task_return_new_error (task, G_SPAWN_EXIT_ERROR, WEXITSTATUS (status),
+                             "'%s' exited with status %d", data->command, WEXITSTATUS (status));
+
+  else
+    g_task_return_new_error (task, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                             "'%s' was killed by signal %d", data->command, WTERMSIG (status));
+
+  g_object_unref (task);
+}
+
+/* Runs a helper program without blocking the main loop.  argv[0] must
+ * be an absolute path: there is no PATH lookup and no shell.  The
+ * callback is invoked once the helper has exited; use
+ * spawn_helper_finish() to find out if it exited successfully.
+ */
+void
+spawn_helper (const gchar * const *argv,
+              GAsyncReadyCallback  callback,
+              gpointer             user_data)
+{
+  SpawnData *data;
+  GTask *task;
+  pid_t pid;
+  gint r;
+
+  g_return_if_fail (argv != NULL && argv[0] != NULL);
+
+  data = g_slice_new (SpawnData);
+  data->command = g_strjoinv (" ", (gchar **) argv);
+  data->start_time = g_get_monotonic_time ();
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_task_data (task, data, spawn_data_free);
+
+  if (shim_is_dry_run ())
+    {
+      g_debug ("Not running '%s' (dry run)", argv[0]);
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  SHIM_PROBE1 (spawn__entry, data->command);
+
+  r = launcher_spawn (argv, &pid);
+  if (r != 0)
+    {
+      SHIM_PROBE4 (spawn__return, data->command, -1, g_get_monotonic_time () - data->start_time, -1);
+      stats_record_error (STATS_SPAWN, data->command);
+      g_task_return_new_error (task, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                               "Failed to execute '%s': %s", argv[0], g_strerror (r));
+      g_object_unref (task);
+      return;
+    }
+
+  g_child_watch_add (pid, spawn_helper_exited, task);
+}
+
+gboolean
+spawn_helper_finish (GAsyncResult  *result,
+                     GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
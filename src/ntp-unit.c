@@ -20,6 +20,10 @@
  */
 
 #include "unit.h"
+#include "launcher.h"
+#include "proc-tracker.h"
+#include "shim.h"
+#include "upstart.h"
 
 #include <stdio.h>
 
@@ -27,71 +31,387 @@
 #define NTPDATE_DISABLED  "/etc/network/if-up.d/ntpdate.disabled"
 #define NTPDATE_AVAILABLE "/usr/sbin/ntpdate-debian"
 #define NTPD_AVAILABLE    "/usr/sbin/ntpd"
+#define NTPD_PIDFILE      "/var/run/ntpd.pid"
+
+#define NTPDATE_DIR       "/etc/network/if-up.d"
+#define NTP_SBIN_DIR      "/usr/sbin"
+#define NTPD_UPSTART_JOB  "ntp"
+
+static const gchar * const ntpdate_argv[] = { NTPDATE_ENABLED, NULL };
+static const gchar * const ntpd_status_argv[] = { "/usr/sbin/service", "ntp", "status", NULL };
+static const gchar * const ntpd_enable_argv[] = { "/usr/sbin/update-rc.d", "ntp", "enable", NULL };
+static const gchar * const ntpd_disable_argv[] = { "/usr/sbin/update-rc.d", "ntp", "disable", NULL };
+static const gchar * const ntpd_restart_argv[] = { "/usr/sbin/service", "ntp", "restart", NULL };
+static const gchar * const ntpd_stop_argv[] = { "/usr/sbin/service", "ntp", "stop", NULL };
+
+/* Everything we know about the NTP setup.  The cache stays valid until
+ * one of the file monitors below notices a change on disk, so repeated
+ * state queries do not have to stat files or ask the init script.
+ */
+static struct
+{
+  gboolean valid;
+  gboolean watched;
+  guint generation;
+
+  gboolean can_use_ntpdate;
+  gboolean using_ntpdate;
+  gboolean can_use_ntpd;
+
+  gboolean ntpd_status_known;
+  gboolean using_ntpd;
+
+  /* Set if ntpd is an upstart job that we can drive over upstart's own
+   * socket; kept until the connection to upstart goes away.
+   */
+  gboolean upstart_checked;
+  gchar *upstart_job;
+} ntp_state;
+
+static void
+ntp_state_invalidate (void)
+{
+  ntp_state.valid = FALSE;
+  ntp_state.ntpd_status_known = FALSE;
+  ntp_state.generation++;
+}
+
+static void
+ntp_state_changed (GFileMonitor      *monitor,
+                   GFile             *file,
+                   GFile             *other_file,
+                   GFileMonitorEvent  event_type,
+                   gpointer           user_data)
+{
+  ntp_state_invalidate ();
+}
+
+static void
+ntp_state_upstart_changed (gboolean connection_lost,
+                           gpointer user_data)
+{
+  if (connection_lost)
+    {
+      g_clear_pointer (&ntp_state.upstart_job, g_free);
+      ntp_state.upstart_checked = FALSE;
+    }
+
+  ntp_state_invalidate ();
+}
+
+/* Call with the result of upstart_get_job() for the ntpd job */
+static void
+ntp_state_set_upstart_job (GAsyncResult *result)
+{
+  gchar *job_path;
+
+  job_path = upstart_get_job_finish (result);
+
+  /* Somebody else may have asked at the same time */
+  if (ntp_state.upstart_checked)
+    {
+      g_free (job_path);
+      return;
+    }
+
+  ntp_state.upstart_checked = TRUE;
+  ntp_state.upstart_job = job_path;
+
+  if (job_path)
+    upstart_job_watch (job_path, ntp_state_upstart_changed, NULL);
+}
+
+static void
+ntp_state_watch (void)
+{
+  static const gchar * const watched_paths[] = { NTPDATE_DIR, NTP_SBIN_DIR, NTPD_PIDFILE };
+  static gboolean tried;
+  guint i;
+
+  if (tried)
+    return;
+
+  tried = TRUE;
+
+  for (i = 0; i < G_N_ELEMENTS (watched_paths); i++)
+    {
+      GError *error = NULL;
+      GFileMonitor *monitor;
+      GFile *file;
+
+      file = g_file_new_for_path (watched_paths[i]);
+      monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, &error);
+      g_object_unref (file);
+
+      if (monitor == NULL)
+        {
+          /* Without all of the monitors we can never trust the cache */
+          g_warning ("Unable to monitor '%s': %s", watched_paths[i], error->message);
+          g_error_free (error);
+          return;
+        }
+
+      /* The monitors live for as long as the process does */
+      g_signal_connect (monitor, "changed", G_CALLBACK (ntp_state_changed), NULL);
+    }
+
+  ntp_state.watched = TRUE;
+}
+
+static void
+ntp_state_update (void)
+{
+  if (ntp_state.valid)
+    return;
+
+  ntp_state_watch ();
+
+  ntp_state.can_use_ntpdate = g_file_test (NTPDATE_AVAILABLE, G_FILE_TEST_EXISTS);
+  ntp_state.using_ntpdate = ntp_state.can_use_ntpdate && g_file_test (NTPDATE_ENABLED, G_FILE_TEST_EXISTS);
+  ntp_state.can_use_ntpd = g_file_test (NTPD_AVAILABLE, G_FILE_TEST_EXISTS);
+  ntp_state.ntpd_status_known = FALSE;
+
+  if (ntp_state.can_use_ntpd)
+    {
+      static gboolean tracking;
+
+      if (!tracking)
+        proc_tracker_watch ("ntpd.service", "ntpd", NTPD_PIDFILE);
+
+      tracking = TRUE;
+    }
+
+  ntp_state.valid = ntp_state.watched;
+}
 
 static gboolean
 ntp_unit_get_can_use_ntpdate (void)
 {
-  return g_file_test (NTPDATE_AVAILABLE, G_FILE_TEST_EXISTS);
+  ntp_state_update ();
+
+  return ntp_state.can_use_ntpdate;
 }
 
 static gboolean
 ntp_unit_get_using_ntpdate (void)
 {
-  if (!ntp_unit_get_can_use_ntpdate ())
-    return FALSE;
+  ntp_state_update ();
 
-  return g_file_test (NTPDATE_ENABLED, G_FILE_TEST_EXISTS);
+  return ntp_state.using_ntpdate;
 }
 
 static gboolean
 ntp_unit_get_can_use_ntpd (void)
 {
-  return g_file_test (NTPD_AVAILABLE, G_FILE_TEST_EXISTS);
+  ntp_state_update ();
+
+  return ntp_state.can_use_ntpd;
 }
 
-static gboolean
-ntp_unit_get_using_ntpd (void)
+/* What a start or stop has to do: possibly move the ntpdate hook, which
+ * happens in the unit's strand, then run the helpers one by one.  If
+ * ntpd is an upstart job, it is restarted or stopped through upstart
+ * once the helpers are done, instead of by one of them.
+ */
+typedef struct
 {
-  int exit_status;
+  const gchar *rename_from;
+  const gchar *rename_to;
+  GQueue *commands;
 
-  if (!ntp_unit_get_can_use_ntpd ())
-    return FALSE;
+  gboolean change_ntpd;
+  gboolean using_ntpd;
+  gchar *upstart_job;
+} NtpOperation;
+
+static NtpOperation *
+ntp_operation_new (void)
+{
+  NtpOperation *op;
+
+  op = g_slice_new0 (NtpOperation);
+  op->commands = g_queue_new ();
+
+  return op;
+}
 
-  if (!g_spawn_command_line_sync ("/usr/sbin/service ntp status", NULL, NULL, &exit_status, NULL))
-    return FALSE;
+static void
+ntp_operation_free (gpointer data)
+{
+  NtpOperation *op = data;
 
-  return exit_status == 0;
+  g_queue_free (op->commands);
+  g_free (op->upstart_job);
+  g_slice_free (NtpOperation, op);
 }
 
 static void
-ntp_unit_set_using_ntpdate (gboolean using_ntp)
+ntp_unit_set_using_ntpdate (gboolean      using_ntp,
+                            NtpOperation *op)
 {
   if (using_ntp == ntp_unit_get_using_ntpdate ())
     return;
 
   if (using_ntp)
     {
-      rename (NTPDATE_DISABLED, NTPDATE_ENABLED);
+      op->rename_from = NTPDATE_DISABLED;
+      op->rename_to = NTPDATE_ENABLED;
 
       /* Kick start ntpdate to sync time immediately */
-      g_spawn_command_line_sync ("/etc/network/if-up.d/ntpdate", NULL, NULL, NULL, NULL);
+      g_queue_push_tail (op->commands, (gpointer) ntpdate_argv);
     }
   else
-    rename (NTPDATE_ENABLED, NTPDATE_DISABLED);
+    {
+      op->rename_from = NTPDATE_ENABLED;
+      op->rename_to = NTPDATE_DISABLED;
+    }
 }
 
 static void
-ntp_unit_set_using_ntpd (gboolean using_ntp)
+ntp_unit_set_using_ntpd (gboolean      using_ntp,
+                         NtpOperation *op)
 {
-  char *cmd;
+  op->change_ntpd = TRUE;
+  op->using_ntpd = using_ntp;
+}
+
+static void ntp_unit_run_next_command (GTask *task);
 
-  cmd = g_strconcat ("/usr/sbin/update-rc.d ntp ", using_ntp ? "enable" : "disable", NULL);
-  g_spawn_command_line_sync (cmd, NULL, NULL, NULL, NULL);
-  g_free (cmd);
+static void
+ntp_unit_command_done (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  GTask *task = user_data;
 
-  cmd = g_strconcat ("/usr/sbin/service ntp ", using_ntp ? "restart" : "stop", NULL);;
-  g_spawn_command_line_sync (cmd, NULL, NULL, NULL, NULL);
-  g_free (cmd);
+  /* Failures of the individual helpers were never reported to the
+   * caller, so just carry on with the next one.
+   */
+  spawn_helper_finish (result, NULL);
+  ntp_unit_run_next_command (task);
+}
+
+static void
+ntp_unit_upstart_done (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  GError *error = NULL;
+
+  /* As for the helpers, a failure is not reported to the caller */
+  if (!upstart_job_control_finish (result, &error))
+    {
+      g_warning ("Unable to control ntpd through upstart: %s", error->message);
+      g_error_free (error);
+    }
+
+  ntp_unit_run_next_command (user_data);
+}
+
+static void
+ntp_unit_run_next_command (GTask *task)
+{
+  NtpOperation *op = g_task_get_task_data (task);
+  const gchar * const *argv;
+
+  argv = g_queue_pop_head (op->commands);
+
+  if (argv == NULL && op->change_ntpd && op->upstart_job)
+    {
+      op->change_ntpd = FALSE;
+      upstart_job_control (op->upstart_job, op->using_ntpd ? UPSTART_JOB_RESTART : UPSTART_JOB_STOP,
+                           ntp_unit_upstart_done, task);
+      return;
+    }
+
+  if (argv == NULL)
+    {
+      /* Don't wait for the monitors to tell us what we just did */
+      ntp_state_invalidate ();
+
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  spawn_helper (argv, ntp_unit_command_done, task);
+}
+
+/* Runs in the unit's strand */
+static void
+ntp_unit_rename (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+  NtpOperation *op = task_data;
+
+  /* Failures were never reported to the caller */
+  if (!shim_is_dry_run ())
+    rename (op->rename_from, op->rename_to);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+ntp_unit_renamed (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  ntp_state_invalidate ();
+  ntp_unit_run_next_command (user_data);
+}
+
+static void
+ntp_unit_run_operation (GTask *task)
+{
+  NtpOperation *op = g_task_get_task_data (task);
+  GTask *rename_task;
+
+  if (op->change_ntpd)
+    {
+      if (ntp_state.upstart_job)
+        op->upstart_job = g_strdup (ntp_state.upstart_job);
+      else
+        {
+          g_queue_push_tail (op->commands, (gpointer) (op->using_ntpd ? ntpd_enable_argv : ntpd_disable_argv));
+          g_queue_push_tail (op->commands, (gpointer) (op->using_ntpd ? ntpd_restart_argv : ntpd_stop_argv));
+        }
+    }
+
+  if (op->rename_from == NULL)
+    {
+      ntp_unit_run_next_command (task);
+      return;
+    }
+
+  rename_task = g_task_new (g_task_get_source_object (task), NULL, ntp_unit_renamed, task);
+  g_task_set_task_data (rename_task, op, NULL);
+  unit_run_in_strand (g_task_get_source_object (task), rename_task, ntp_unit_rename);
+  g_object_unref (rename_task);
+}
+
+static void
+ntp_unit_run_got_upstart_job (GObject      *source,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  ntp_state_set_upstart_job (result);
+  ntp_unit_run_operation (user_data);
+}
+
+static void
+ntp_unit_run (GTask        *task,
+              NtpOperation *op)
+{
+  g_task_set_task_data (task, op, ntp_operation_free);
+
+  if (op->change_ntpd && !ntp_state.upstart_checked)
+    {
+      upstart_get_job (NTPD_UPSTART_JOB, ntp_unit_run_got_upstart_job, task);
+      return;
+    }
+
+  ntp_unit_run_operation (task);
 }
 
 typedef Unit NtpUnit;
@@ -101,32 +421,141 @@ static GType ntp_unit_get_type (void);
 G_DEFINE_TYPE (NtpUnit, ntp_unit, UNIT_TYPE)
 
 static void
-ntp_unit_start (Unit *unit)
+ntp_unit_start (Unit  *unit,
+                GTask *task)
 {
+  NtpOperation *op = ntp_operation_new ();
+
   if (ntp_unit_get_can_use_ntpdate ())
-    ntp_unit_set_using_ntpdate (TRUE);
+    ntp_unit_set_using_ntpdate (TRUE, op);
 
   if (ntp_unit_get_can_use_ntpd ())
-    ntp_unit_set_using_ntpd (TRUE);
+    ntp_unit_set_using_ntpd (TRUE, op);
+
+  ntp_unit_run (task, op);
 }
 
 static void
-ntp_unit_stop (Unit *unit)
+ntp_unit_stop (Unit  *unit,
+               GTask *task)
 {
+  NtpOperation *op = ntp_operation_new ();
+
   if (ntp_unit_get_can_use_ntpdate ())
-    ntp_unit_set_using_ntpdate (FALSE);
+    ntp_unit_set_using_ntpdate (FALSE, op);
 
   if (ntp_unit_get_can_use_ntpd ())
-    ntp_unit_set_using_ntpd (FALSE);
+    ntp_unit_set_using_ntpd (FALSE, op);
+
+  ntp_unit_run (task, op);
 }
 
 static const gchar *
-ntp_unit_get_state (Unit *unit)
+ntp_unit_peek_state (Unit *unit)
 {
-  if (ntp_unit_get_using_ntpdate () || ntp_unit_get_using_ntpd ())
+  ntp_state_update ();
+
+  if (ntp_state.using_ntpdate)
     return "enabled";
-  else
+
+  if (!ntp_state.can_use_ntpd)
     return "disabled";
+
+  switch (proc_tracker_is_running ("ntpd.service"))
+    {
+    case 1:
+      return "enabled";
+
+    case 0:
+      return "disabled";
+    }
+
+  if (ntp_state.ntpd_status_known)
+    return ntp_state.using_ntpd ? "enabled" : "disabled";
+
+  return NULL;
+}
+
+static void
+ntp_unit_return_ntpd_status (GTask    *task,
+                             gboolean  running)
+{
+  /* Only remember the answer if nothing changed while we were asking */
+  if (ntp_state.valid && ntp_state.generation == GPOINTER_TO_UINT (g_task_get_task_data (task)))
+    {
+      ntp_state.using_ntpd = running;
+      ntp_state.ntpd_status_known = TRUE;
+    }
+
+  g_task_return_pointer (task, (gpointer) (running ? "enabled" : "disabled"), NULL);
+  g_object_unref (task);
+}
+
+static void
+ntp_unit_got_ntpd_status (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  ntp_unit_return_ntpd_status (user_data, spawn_helper_finish (result, NULL));
+}
+
+static void
+ntp_unit_got_upstart_status (GObject      *source,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  gboolean running = FALSE;
+  GError *error = NULL;
+
+  if (!upstart_job_get_running_finish (result, &running, &error))
+    {
+      g_warning ("Unable to ask upstart about ntpd: %s", error->message);
+      g_error_free (error);
+    }
+
+  ntp_unit_return_ntpd_status (user_data, running);
+}
+
+static void
+ntp_unit_query_ntpd (GTask *task)
+{
+  if (ntp_state.upstart_job)
+    upstart_job_get_running (ntp_state.upstart_job, ntp_unit_got_upstart_status, task);
+  else
+    spawn_helper (ntpd_status_argv, ntp_unit_got_ntpd_status, task);
+}
+
+static void
+ntp_unit_state_got_upstart_job (GObject      *source,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  ntp_state_set_upstart_job (result);
+  ntp_unit_query_ntpd (user_data);
+}
+
+static void
+ntp_unit_get_state (Unit  *unit,
+                    GTask *task)
+{
+  const gchar *state;
+
+  state = ntp_unit_peek_state (unit);
+
+  if (state)
+    {
+      g_task_return_pointer (task, (gpointer) state, NULL);
+      g_object_unref (task);
+      return;
+    }
+
+  /* Only upstart or the init script can tell us; ask without blocking */
+  g_task_set_task_data (task, GUINT_TO_POINTER (ntp_state.generation), NULL);
+
+  if (!ntp_state.upstart_checked)
+    upstart_get_job (NTPD_UPSTART_JOB, ntp_unit_state_got_upstart_job, task);
+  else
+    ntp_unit_query_ntpd (task);
 }
 
 Unit *
@@ -148,5 +577,6 @@ ntp_unit_class_init (UnitClass *class)
 {
   class->start = ntp_unit_start;
   class->stop = ntp_unit_stop;
+  class->peek_state = ntp_unit_peek_state;
   class->get_state = ntp_unit_get_state;
 }
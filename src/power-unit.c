@@ -18,12 +18,18 @@
  */
 
 #include "unit.h"
+#include "launcher.h"
+#include "state.h"
+#include "shim.h"
+#include "sleep-hooks.h"
+#include "sleep-history.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 typedef UnitClass PowerUnitClass;
 static GType power_unit_get_type (void);
@@ -39,6 +45,7 @@ typedef struct
 {
   Unit parent_instance;
   PowerAction action;
+  SleepRecord *sleep_record;
 } PowerUnit;
 
 G_DEFINE_TYPE (PowerUnit, power_unit, UNIT_TYPE)
@@ -46,10 +53,155 @@ G_DEFINE_TYPE (PowerUnit, power_unit, UNIT_TYPE)
 gboolean in_shutdown;
 
 static void
-power_unit_start (Unit *unit)
+power_unit_action_finished (GTask  *task,
+                            GError *error)
+{
+  PowerUnit *pu = g_task_get_source_object (task);
+
+  if (error)
+    {
+      g_warning ("Error while running '%s': %s", power_cmds[pu->action], error->message);
+    }
+
+  if (pu->sleep_record)
+    {
+      sleep_record_finish (pu->sleep_record, error == NULL);
+      pu->sleep_record = NULL;
+    }
+
+  g_clear_error (&error);
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+static void
+power_unit_helper_done (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  PowerUnit *pu = g_task_get_source_object (user_data);
+  GError *error = NULL;
+
+  spawn_helper_finish (result, &error);
+
+  /* pm-utils only returns once the system is back */
+  if (pu->sleep_record)
+    {
+      sleep_record_mark (pu->sleep_record, SLEEP_MARK_RESUMED);
+      if (error == NULL)
+        sleep_record_resumed (pu->sleep_record);
+    }
+
+  power_unit_action_finished (user_data, error);
+}
+
+static const gchar *
+power_unit_get_sleep_kind (PowerUnit *pu)
+{
+  return (pu->action == POWER_SUSPEND) ? "suspend" : "hibernate";
+}
+
+static void
+power_unit_post_hooks_done (GObject      *source,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  GTask *task = user_data;
+
+  sleep_hooks_run_finish (result);
+  power_unit_action_finished (task, g_task_get_task_data (task));
+}
+
+static void
+power_unit_sleep_done (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  /* The post hooks run even if we never went to sleep, so that they can
+   * undo what the pre hooks did.  Any error is passed along to
+   * power_unit_action_finished(), which frees it.
+   */
+  if (g_task_propagate_boolean (G_TASK (result), &error))
+    sleep_record_resumed (((PowerUnit *) g_task_get_source_object (task))->sleep_record);
+  g_task_set_task_data (task, error, NULL);
+
+  sleep_hooks_run ("post", power_unit_get_sleep_kind (g_task_get_source_object (task)),
+                   power_unit_post_hooks_done, task);
+}
+
+/* Runs in a worker thread: the write() only returns after resume */
+static void
+power_unit_write_sys_state (GTask        *task,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+  PowerUnit *pu = source_object;
+  const gchar *kind;
+  gssize r;
+  gint fd;
+
+  fd = open ("/sys/power/state", O_WRONLY);
+  if (fd == -1)
+    {
+      /* We never got to the kernel; don't leave the marks unset */
+      sleep_record_mark (pu->sleep_record, SLEEP_MARK_ENTERING);
+      sleep_record_mark (pu->sleep_record, SLEEP_MARK_RESUMED);
+      g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errno),
+                               "Could not open /sys/power/state");
+      return;
+    }
+
+  kind = (pu->action == POWER_SUSPEND) ? "mem" : "disk";
+  sleep_record_mark (pu->sleep_record, SLEEP_MARK_ENTERING);
+  r = write (fd, kind, strlen (kind));
+  sleep_record_mark (pu->sleep_record, SLEEP_MARK_RESUMED);
+
+  if (r != strlen (kind))
+    {
+      g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errno),
+                               "Failed to write() to /sys/power/state?!?");
+      close (fd);
+      return;
+    }
+
+  close (fd);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+power_unit_pre_hooks_done (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  GTask *task = user_data;
+  GTask *sleep_task;
+
+  sleep_hooks_run_finish (result);
+
+  sleep_task = g_task_new (g_task_get_source_object (task), NULL, power_unit_sleep_done, task);
+  unit_run_in_strand (g_task_get_source_object (task), sleep_task, power_unit_write_sys_state);
+  g_object_unref (sleep_task);
+}
+
+static void
+power_unit_start (Unit  *unit,
+                  GTask *task)
 {
   PowerUnit *pu = (PowerUnit *) unit;
-  static gint64 last_suspend_time;
+  const gchar *argv[] = { power_cmds[pu->action], NULL };
+
+  /* Nothing below may touch the system in a dry run.  The helper will
+   * not actually be run either.
+   */
+  if (shim_is_dry_run ())
+    {
+      spawn_helper (argv, power_unit_helper_done, task);
+      return;
+    }
 
   /* If we request power off or reboot actions then we should ignore any
    * suspend or hibernate actions that come after this.
@@ -62,6 +214,10 @@ power_unit_start (Unit *unit)
 
       in_shutdown = TRUE;
 
+      /* In case we get killed anyway and activated again, the new
+       * instance must still know that we are shutting down. */
+      shim_state_save ();
+
       /* avoid being killed during shutdown, so that we can keep our
        * in_shutdown state */
       pid_str = g_strdup_printf ("%u", (unsigned) getpid ());
@@ -73,67 +229,56 @@ power_unit_start (Unit *unit)
           g_error_free (error);
         }
 
-      if (system (power_cmds[pu->action]) != 0)
-        g_warning ("Error while running '%s'", power_cmds[pu->action]);
+      spawn_helper (argv, power_unit_helper_done, task);
     }
   else
     {
       if (in_shutdown)
-        return;
-
-      /* This is pretty ugly: if we are being asked to perform a suspend
-       * or hibernate action within 1 second of the previous one, don't
-       * do it.
-       *
-       * We will be able to do this properly once we forward the
-       * timestamp of the event that caused the suspend all the way
-       * down.
-       */
-      if (pu->action == POWER_SUSPEND && last_suspend_time + G_TIME_SPAN_SECOND > g_get_monotonic_time ())
-        return;
+        {
+          g_task_return_boolean (task, TRUE);
+          g_object_unref (task);
+          return;
+        }
 
       /* pm-utils might not have been installed, so go the direct route
-       * if we find that we don't have it...
+       * if we find that we don't have it...  The direct route is also
+       * taken if the admin asked for our own hooks, which run in
+       * parallel rather than one after another.
        */
-      if (g_file_test (power_cmds[pu->action], G_FILE_TEST_IS_EXECUTABLE))
+      pu->sleep_record = sleep_record_new (power_unit_get_sleep_kind (pu));
+
+      if (g_file_test (power_cmds[pu->action], G_FILE_TEST_IS_EXECUTABLE) && !sleep_hooks_enabled ())
         {
-          if (system (power_cmds[pu->action]) != 0)
-            g_warning ("Error while running '%s'", power_cmds[pu->action]);
+          sleep_record_mark (pu->sleep_record, SLEEP_MARK_ENTERING);
+          spawn_helper (argv, power_unit_helper_done, task);
         }
       else
-        {
-          const gchar *kind;
-          gint fd;
-
-          fd = open ("/sys/power/state", O_WRONLY);
-          if (fd == -1)
-            {
-              g_warning ("Could not open /sys/power/state");
-              return;
-            }
-
-          kind = (pu->action == POWER_SUSPEND) ? "mem" : "disk";
-          if (write (fd, kind, strlen (kind)) != strlen (kind))
-            g_warning ("Failed to write() to /sys/power/state?!?");
-          close (fd);
-        }
-
-      if (pu->action == POWER_SUSPEND)
-        last_suspend_time = g_get_monotonic_time ();
+        sleep_hooks_run ("pre", power_unit_get_sleep_kind (pu), power_unit_pre_hooks_done, task);
     }
 }
 
 static void
-power_unit_stop (Unit *unit)
+power_unit_stop (Unit  *unit,
+                 GTask *task)
 {
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
 }
 
 static const gchar *
-power_unit_get_state (Unit *unit)
+power_unit_peek_state (Unit *unit)
 {
   return "static";
 }
 
+static void
+power_unit_get_state (Unit  *unit,
+                      GTask *task)
+{
+  g_task_return_pointer (task, (gpointer) power_unit_peek_state (unit), NULL);
+  g_object_unref (task);
+}
+
 Unit *
 power_unit_new (PowerAction action)
 {
@@ -157,5 +302,6 @@ power_unit_class_init (UnitClass *class)
 {
   class->start = power_unit_start;
   class->stop = power_unit_stop;
+  class->peek_state = power_unit_peek_state;
   class->get_state = power_unit_get_state;
 }
@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _probes_h_
+#define _probes_h_
+
+/* Static tracepoints (USDT) for tracing a running shim, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/lib/systemd-shim/systemd-shim:systemd_shim:method__return
+ *                { @[str(arg0)] = hist(arg1); }'
+ *
+ * A probe that nothing is attached to is a single nop.  All durations
+ * are in microseconds.
+ *
+ *   method__entry (method)                     Manager method call
+ *   method__return (method, usec)
+ *   property__entry (property)                 Manager property read
+ *   property__return (property, usec)
+ *   lookup__unit__entry (unit)
+ *   lookup__unit__return (unit, found)
+ *   module__load__entry (path)                 first use of a unit module
+ *   module__load__return (path, success)
+ *   unit__start__entry (unit, job_id)          a job starts running
+ *   unit__start__return (unit, job_id, usec, success)
+ *   unit__stop__entry (unit, job_id)
+ *   unit__stop__return (unit, job_id, usec, success)
+ *   virt__detect__entry ()                     uncached detection only
+ *   virt__detect__return (virtualization, usec)
+ *   spawn__entry (command)                     helper program
+ *   spawn__return (command, pid, usec, wait_status)  pid -1 if it failed
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define SHIM_PROBE0(name)                DTRACE_PROBE (systemd_shim, name)
+#define SHIM_PROBE1(name, a)             DTRACE_PROBE1 (systemd_shim, name, a)
+#define SHIM_PROBE2(name, a, b)          DTRACE_PROBE2 (systemd_shim, name, a, b)
+#define SHIM_PROBE3(name, a, b, c)       DTRACE_PROBE3 (systemd_shim, name, a, b, c)
+#define SHIM_PROBE4(name, a, b, c, d)    DTRACE_PROBE4 (systemd_shim, name, a, b, c, d)
+
+#else
+
+/* The arguments are mentioned but never evaluated, so that variables
+ * that only feed probes don't cause warnings.
+ */
+#define SHIM_PROBE0(name)                do { } while (0)
+#define SHIM_PROBE1(name, a)             do { if (0) { (void) (a); } } while (0)
+#define SHIM_PROBE2(name, a, b)          do { if (0) { (void) (a); (void) (b); } } while (0)
+#define SHIM_PROBE3(name, a, b, c)       do { if (0) { (void) (a); (void) (b); (void) (c); } } while (0)
+#define SHIM_PROBE4(name, a, b, c, d)    do { if (0) { (void) (a); (void) (b); (void) (c); (void) (d); } } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* _probes_h_ */
@@ -0,0 +1,377 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "proc-tracker.h"
+
+#include <glib-unix.h>
+
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* Keeps track of which of the daemons we are interested in are running,
+ * without having to ask their init scripts.  We seed ourselves from the
+ * pidfiles and one scan of /proc and then follow fork, exec and exit
+ * events from the kernel's process connector.  Forks matter because a
+ * daemon that detaches (ntpd does) keeps running in a child whose
+ * exec'd parent exits.
+ *
+ * Subscribing to the connector needs CAP_NET_ADMIN.  If that fails (or
+ * the socket dies later on) we report the state as unknown and callers
+ * fall back to asking the init scripts.
+ */
+
+typedef struct
+{
+  gchar *name;
+  gchar *comm;
+  gchar *pidfile;
+  guint n_pids;
+} TrackedDaemon;
+
+static GPtrArray *tracked_daemons;
+static GHashTable *tracked_pids;
+static gint proc_socket = -1;
+static gboolean tracker_live;
+
+static gchar *
+proc_tracker_get_comm (pid_t pid)
+{
+  gchar *path;
+  gchar *comm;
+
+  path = g_strdup_printf ("/proc/%d/comm", (int) pid);
+  if (!g_file_get_contents (path, &comm, NULL, NULL))
+    comm = NULL;
+  g_free (path);
+
+  if (comm)
+    g_strchomp (comm);
+
+  return comm;
+}
+
+static void
+proc_tracker_insert_pid (pid_t          pid,
+                         TrackedDaemon *tracked)
+{
+  if (g_hash_table_contains (tracked_pids, GINT_TO_POINTER (pid)))
+    return;
+
+  g_hash_table_insert (tracked_pids, GINT_TO_POINTER (pid), tracked);
+  tracked->n_pids++;
+}
+
+static void
+proc_tracker_add_pid (pid_t        pid,
+                      const gchar *comm)
+{
+  guint i;
+
+  for (i = 0; i < tracked_daemons->len; i++)
+    {
+      TrackedDaemon *tracked = g_ptr_array_index (tracked_daemons, i);
+
+      if (g_str_equal (tracked->comm, comm))
+        {
+          proc_tracker_insert_pid (pid, tracked);
+          return;
+        }
+    }
+}
+
+static void
+proc_tracker_check_pid (pid_t pid)
+{
+  gchar *comm;
+
+  comm = proc_tracker_get_comm (pid);
+  if (comm == NULL)
+    return;
+
+  proc_tracker_add_pid (pid, comm);
+  g_free (comm);
+}
+
+static void
+proc_tracker_remove_pid (pid_t pid)
+{
+  TrackedDaemon *tracked;
+
+  tracked = g_hash_table_lookup (tracked_pids, GINT_TO_POINTER (pid));
+  if (tracked == NULL)
+    return;
+
+  g_hash_table_remove (tracked_pids, GINT_TO_POINTER (pid));
+  tracked->n_pids--;
+}
+
+static void
+proc_tracker_read_pidfile (TrackedDaemon *tracked)
+{
+  gchar *contents;
+  gint64 pid;
+
+  if (tracked->pidfile == NULL || !g_file_get_contents (tracked->pidfile, &contents, NULL, NULL))
+    return;
+
+  pid = g_ascii_strtoll (contents, NULL, 10);
+  g_free (contents);
+
+  if (pid > 0 && pid <= G_MAXINT)
+    proc_tracker_check_pid (pid);
+}
+
+static void
+proc_tracker_scan (void)
+{
+  const gchar *name;
+  GDir *dir;
+  guint i;
+
+  for (i = 0; i < tracked_daemons->len; i++)
+    {
+      TrackedDaemon *tracked = g_ptr_array_index (tracked_daemons, i);
+
+      tracked->n_pids = 0;
+    }
+
+  g_hash_table_remove_all (tracked_pids);
+
+  for (i = 0; i < tracked_daemons->len; i++)
+    proc_tracker_read_pidfile (g_ptr_array_index (tracked_daemons, i));
+
+  dir = g_dir_open ("/proc", 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)))
+    if (g_ascii_isdigit (name[0]))
+      proc_tracker_check_pid (g_ascii_strtoll (name, NULL, 10));
+
+  g_dir_close (dir);
+}
+
+static void
+proc_tracker_shutdown (void)
+{
+  g_warning ("Lost the process connector; falling back to init scripts");
+
+  close (proc_socket);
+  proc_socket = -1;
+  tracker_live = FALSE;
+}
+
+static void
+proc_tracker_handle_event (const struct proc_event *ev)
+{
+  TrackedDaemon *tracked;
+
+  switch (ev->what)
+    {
+    case PROC_EVENT_FORK:
+      /* A new process (not a thread) of a tracked daemon belongs to the
+       * same daemon until it execs something else.
+       */
+      if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+        {
+          tracked = g_hash_table_lookup (tracked_pids, GINT_TO_POINTER (ev->event_data.fork.parent_tgid));
+          if (tracked)
+            proc_tracker_insert_pid (ev->event_data.fork.child_pid, tracked);
+        }
+      break;
+
+    case PROC_EVENT_EXEC:
+      /* Only whole processes, not their threads */
+      if (ev->event_data.exec.process_pid == ev->event_data.exec.process_tgid)
+        {
+          /* Something else may have been exec'd under a tracked pid */
+          proc_tracker_remove_pid (ev->event_data.exec.process_pid);
+          proc_tracker_check_pid (ev->event_data.exec.process_pid);
+        }
+      break;
+
+    case PROC_EVENT_EXIT:
+      if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+        proc_tracker_remove_pid (ev->event_data.exit.process_pid);
+      break;
+
+    default:
+      break;
+    }
+}
+
+static gboolean
+proc_tracker_readable (gint         fd,
+                       GIOCondition condition,
+                       gpointer     user_data)
+{
+  for (;;)
+    {
+      union {
+        struct nlmsghdr hdr;
+        gchar buf[4096];
+      } msg;
+      struct nlmsghdr *hdr;
+      ssize_t len;
+
+      len = recv (fd, &msg, sizeof msg, 0);
+
+      if (len < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          if (errno == EAGAIN)
+            return G_SOURCE_CONTINUE;
+
+          /* We missed some events; start over from /proc */
+          if (errno == ENOBUFS)
+            {
+              proc_tracker_scan ();
+              continue;
+            }
+
+          proc_tracker_shutdown ();
+          return G_SOURCE_REMOVE;
+        }
+
+      if (len == 0)
+        {
+          proc_tracker_shutdown ();
+          return G_SOURCE_REMOVE;
+        }
+
+      for (hdr = &msg.hdr; NLMSG_OK (hdr, len); hdr = NLMSG_NEXT (hdr, len))
+        {
+          const struct cn_msg *cn;
+
+          if (hdr->nlmsg_type == NLMSG_NOOP || hdr->nlmsg_type == NLMSG_ERROR)
+            continue;
+
+          cn = NLMSG_DATA (hdr);
+          if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+            continue;
+
+          proc_tracker_handle_event ((const struct proc_event *) cn->data);
+        }
+    }
+}
+
+static gboolean
+proc_tracker_subscribe (void)
+{
+  struct sockaddr_nl addr = { 0 };
+  union {
+    struct nlmsghdr hdr;
+    gchar buf[NLMSG_SPACE (sizeof (struct cn_msg) + sizeof (enum proc_cn_mcast_op))];
+  } msg;
+  struct cn_msg *cn;
+
+  proc_socket = socket (PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_CONNECTOR);
+  if (proc_socket < 0)
+    return FALSE;
+
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid = getpid ();
+
+  if (bind (proc_socket, (struct sockaddr *) &addr, sizeof addr) < 0)
+    goto fail;
+
+  memset (&msg, 0, sizeof msg);
+  msg.hdr.nlmsg_len = NLMSG_LENGTH (sizeof (struct cn_msg) + sizeof (enum proc_cn_mcast_op));
+  msg.hdr.nlmsg_type = NLMSG_DONE;
+  msg.hdr.nlmsg_pid = getpid ();
+
+  cn = NLMSG_DATA (&msg.hdr);
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof (enum proc_cn_mcast_op);
+  *(enum proc_cn_mcast_op *) cn->data = PROC_CN_MCAST_LISTEN;
+
+  if (send (proc_socket, &msg, msg.hdr.nlmsg_len, 0) < 0)
+    goto fail;
+
+  g_unix_fd_add (proc_socket, G_IO_IN, proc_tracker_readable, NULL);
+
+  return TRUE;
+
+fail:
+  close (proc_socket);
+  proc_socket = -1;
+
+  return FALSE;
+}
+
+void
+proc_tracker_watch (const gchar *name,
+                    const gchar *comm,
+                    const gchar *pidfile)
+{
+  TrackedDaemon *tracked;
+
+  g_return_if_fail (name != NULL && comm != NULL);
+
+  if (tracked_daemons == NULL)
+    {
+      tracked_daemons = g_ptr_array_new ();
+      tracked_pids = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+      tracker_live = proc_tracker_subscribe ();
+      if (!tracker_live)
+        g_debug ("Process connector not available; using init scripts");
+    }
+
+  tracked = g_new0 (TrackedDaemon, 1);
+  tracked->name = g_strdup (name);
+  tracked->comm = g_strdup (comm);
+  tracked->pidfile = g_strdup (pidfile);
+  g_ptr_array_add (tracked_daemons, tracked);
+
+  /* We subscribed before scanning so that nothing falls in between */
+  if (tracker_live)
+    proc_tracker_scan ();
+}
+
+/* Returns 1 if the tracked is running, 0 if it is not, or -1 if we can't
+ * tell without asking its init script.
+ */
+gint
+proc_tracker_is_running (const gchar *name)
+{
+  guint i;
+
+  if (!tracker_live)
+    return -1;
+
+  for (i = 0; i < tracked_daemons->len; i++)
+    {
+      TrackedDaemon *tracked = g_ptr_array_index (tracked_daemons, i);
+
+      if (g_str_equal (tracked->name, name))
+        return tracked->n_pids > 0;
+    }
+
+  return -1;
+}
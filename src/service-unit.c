@@ -0,0 +1,312 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "unit.h"
+#include "units-index.h"
+#include "launcher.h"
+#include "upstart.h"
+
+#include <glob.h>
+#include <string.h>
+
+/* Units that are mapped to a sysvinit script or an upstart job by the
+ * drop-ins in units.d.  Upstart jobs are started and stopped by asking
+ * upstart directly; everything else, and upstart jobs when upstart
+ * can't be reached, goes through service(8), which knows how to deal
+ * with either.
+ */
+
+#define SERVICE_COMMAND "/usr/sbin/service"
+
+typedef struct
+{
+  Unit parent_instance;
+  gchar *job;
+  UnitsIndexType type;
+} ServiceUnit;
+
+typedef UnitClass ServiceUnitClass;
+static GType service_unit_get_type (void);
+
+G_DEFINE_TYPE (ServiceUnit, service_unit, UNIT_TYPE)
+
+/* unit name → Unit, for the units looked up so far */
+static GHashTable *service_units;
+
+static void
+service_unit_helper_done (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  if (spawn_helper_finish (result, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+static void
+service_unit_run (ServiceUnit *su,
+                  const gchar *action,
+                  GTask       *task)
+{
+  const gchar *argv[] = { SERVICE_COMMAND, su->job, action, NULL };
+
+  spawn_helper (argv, service_unit_helper_done, task);
+}
+
+static void
+service_unit_upstart_done (GObject      *source,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+
+  if (upstart_job_control_finish (result, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+static void
+service_unit_got_upstart_job (GObject      *source,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  GTask *task = user_data;
+  ServiceUnit *su = g_task_get_source_object (task);
+  gboolean start = GPOINTER_TO_INT (g_task_get_task_data (task));
+  gchar *job_path;
+
+  job_path = upstart_get_job_finish (result);
+
+  if (job_path == NULL)
+    {
+      service_unit_run (su, start ? "start" : "stop", task);
+      return;
+    }
+
+  upstart_job_control (job_path, start ? UPSTART_JOB_START : UPSTART_JOB_STOP, service_unit_upstart_done, task);
+  g_free (job_path);
+}
+
+static void
+service_unit_control (ServiceUnit *su,
+                      gboolean     start,
+                      GTask       *task)
+{
+  /* The drop-in went away after the job was queued */
+  if (su->job == NULL)
+    {
+      g_task_return_new_error (task, G_DBUS_ERROR, G_DBUS_ERROR_FILE_NOT_FOUND, "Unit is no longer mapped");
+      g_object_unref (task);
+      return;
+    }
+
+  if (su->type != UNITS_INDEX_UPSTART)
+    {
+      service_unit_run (su, start ? "start" : "stop", task);
+      return;
+    }
+
+  g_task_set_task_data (task, GINT_TO_POINTER (start), NULL);
+  upstart_get_job (su->job, service_unit_got_upstart_job, task);
+}
+
+static void
+service_unit_start (Unit  *unit,
+                    GTask *task)
+{
+  service_unit_control ((ServiceUnit *) unit, TRUE, task);
+}
+
+static void
+service_unit_stop (Unit  *unit,
+                   GTask *task)
+{
+  service_unit_control ((ServiceUnit *) unit, FALSE, task);
+}
+
+static const gchar *
+service_unit_get_sysv_state (const gchar *job)
+{
+  const gchar *state;
+  gchar *pattern;
+  glob_t links;
+
+  /* Enabled if it is started in any of the multi-user runlevels */
+  pattern = g_strdup_printf ("/etc/rc[2-5].d/S[0-9][0-9]%s", job);
+  state = glob (pattern, GLOB_NOSORT, NULL, &links) == 0 ? "enabled" : "disabled";
+  globfree (&links);
+  g_free (pattern);
+
+  return state;
+}
+
+static const gchar *
+service_unit_get_upstart_state (const gchar *job)
+{
+  const gchar *state = "enabled";
+  gchar *contents;
+  gchar *path;
+
+  /* A "manual" stanza in the override file disables the job */
+  path = g_strdup_printf ("/etc/init/%s.override", job);
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      gchar **lines = g_strsplit (contents, "\n", -1);
+      guint i;
+
+      for (i = 0; lines[i]; i++)
+        if (g_str_equal (g_strstrip (lines[i]), "manual"))
+          state = "disabled";
+
+      g_strfreev (lines);
+      g_free (contents);
+    }
+  g_free (path);
+
+  return state;
+}
+
+/* These run in the unit's strand, with their own copy of the job, as
+ * the unit may be remapped in the meantime.
+ */
+static void
+service_unit_find_sysv_state (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+  g_task_return_pointer (task, (gpointer) service_unit_get_sysv_state (task_data), NULL);
+}
+
+static void
+service_unit_find_upstart_state (GTask        *task,
+                                 gpointer      source_object,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+  g_task_return_pointer (task, (gpointer) service_unit_get_upstart_state (task_data), NULL);
+}
+
+static void
+service_unit_get_state (Unit  *unit,
+                        GTask *task)
+{
+  ServiceUnit *su = (ServiceUnit *) unit;
+
+  if (su->job == NULL)
+    {
+      g_task_return_new_error (task, G_DBUS_ERROR, G_DBUS_ERROR_FILE_NOT_FOUND, "Unit is no longer mapped");
+      g_object_unref (task);
+      return;
+    }
+
+  g_task_set_task_data (task, g_strdup (su->job), g_free);
+
+  if (su->type == UNITS_INDEX_UPSTART)
+    unit_run_in_strand (unit, task, service_unit_find_upstart_state);
+  else
+    unit_run_in_strand (unit, task, service_unit_find_sysv_state);
+
+  g_object_unref (task);
+}
+
+/* Called for names that are not in the built-in table.
+ *
+ * The drop-ins can change under a unit that was already looked up, so
+ * its mapping is refreshed from the index every time.  Units are never
+ * freed, as unit objects keep pointers to them; one whose drop-in went
+ * away is kept with a NULL job until it is mapped again.
+ */
+Unit *
+service_unit_lookup (const gchar *unit_name)
+{
+  UnitsIndexType type;
+  const gchar *job;
+  ServiceUnit *su;
+
+  if (service_units == NULL)
+    service_units = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  su = g_hash_table_lookup (service_units, unit_name);
+
+  if (!units_index_lookup (unit_name, &job, &type))
+    {
+      if (su)
+        g_clear_pointer (&su->job, g_free);
+
+      return NULL;
+    }
+
+  if (su == NULL)
+    {
+      su = g_object_new (service_unit_get_type (), NULL);
+      g_hash_table_insert (service_units, g_strdup (unit_name), su);
+    }
+
+  if (g_strcmp0 (su->job, job) != 0)
+    {
+      g_free (su->job);
+      su->job = g_strdup (job);
+    }
+  su->type = type;
+
+  return (Unit *) su;
+}
+
+/* Like unit_modules_foreach(), this only visits the units that have
+ * been looked up, and that were still mapped the last time.
+ */
+void
+service_unit_foreach (UnitForeachFunc func,
+                      gpointer        user_data)
+{
+  GHashTableIter iter;
+  gpointer name, unit;
+
+  if (service_units == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, service_units);
+  while (g_hash_table_iter_next (&iter, &name, &unit))
+    if (((ServiceUnit *) unit)->job)
+      func (name, unit, user_data);
+}
+
+static void
+service_unit_init (ServiceUnit *unit)
+{
+}
+
+static void
+service_unit_class_init (UnitClass *class)
+{
+  class->start = service_unit_start;
+  class->stop = service_unit_stop;
+  class->get_state = service_unit_get_state;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _shim_methods_h_
+#define _shim_methods_h_
+
+#include <stddef.h>
+
+typedef enum
+{
+  SHIM_METHOD_GET_UNIT_FILE_STATE,
+  SHIM_METHOD_DISABLE_UNIT_FILES,
+  SHIM_METHOD_ENABLE_UNIT_FILES,
+  SHIM_METHOD_RELOAD,
+  SHIM_METHOD_START_UNIT,
+  SHIM_METHOD_STOP_UNIT,
+  SHIM_METHOD_SUBSCRIBE,
+  SHIM_METHOD_UNSUBSCRIBE,
+  SHIM_METHOD_LIST_UNITS,
+  SHIM_METHOD_LIST_UNIT_FILES,
+  SHIM_METHOD_GET_UNIT_FILE_STATES,
+  SHIM_METHOD_GET_UNIT,
+  SHIM_METHOD_LOAD_UNIT,
+  SHIM_METHOD_GET_JOB,
+  N_SHIM_METHODS
+} ShimMethod;
+
+/* The method table is generated from shim-methods.gperf */
+struct ShimMethodEntry
+{
+  const char *name;
+  ShimMethod method;
+};
+
+const struct ShimMethodEntry *shim_method_lookup (const char *str, GPERF_LEN_TYPE len);
+
+#endif /* _shim_methods_h_ */
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _shim_properties_h_
+#define _shim_properties_h_
+
+#include <stddef.h>
+
+typedef enum
+{
+  SHIM_PROPERTY_VERSION,
+  SHIM_PROPERTY_FEATURES,
+  SHIM_PROPERTY_ARCHITECTURE,
+  SHIM_PROPERTY_TAINTED,
+  SHIM_PROPERTY_VIRTUALIZATION,
+  SHIM_PROPERTY_N_JOBS,
+  SHIM_PROPERTY_N_INSTALLED_JOBS,
+  N_SHIM_PROPERTIES
+} ShimProperty;
+
+/* The property table is generated from shim-properties.gperf */
+struct ShimPropertyEntry
+{
+  const char *name;
+  ShimProperty property;
+};
+
+const struct ShimPropertyEntry *shim_property_lookup (const char *str, GPERF_LEN_TYPE len);
+
+#endif /* _shim_properties_h_ */
@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "shim-replies.h"
+
+static const gchar * const unit_file_states[] = { "enabled", "disabled", "static" };
+static GVariant *unit_file_state_replies[G_N_ELEMENTS (unit_file_states)];
+static GVariant *no_changes_reply;
+static GVariant *enable_reply;
+
+void
+shim_replies_init (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (unit_file_states); i++)
+    unit_file_state_replies[i] = g_variant_ref_sink (g_variant_new ("(s)", unit_file_states[i]));
+
+  no_changes_reply = g_variant_ref_sink (g_variant_new ("(a(sss))", NULL));
+  enable_reply = g_variant_ref_sink (g_variant_new ("(ba(sss))", TRUE, NULL));
+}
+
+GVariant *
+shim_reply_unit_file_state (const gchar *state)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (unit_file_states); i++)
+    if (g_str_equal (state, unit_file_states[i]))
+      return unit_file_state_replies[i];
+
+  return NULL;
+}
+
+GVariant *
+shim_reply_no_changes (void)
+{
+  return no_changes_reply;
+}
+
+GVariant *
+shim_reply_enable (void)
+{
+  return enable_reply;
+}
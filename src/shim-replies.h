@@ -0,0 +1,36 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _shim_replies_h_
+#define _shim_replies_h_
+
+#include <gio/gio.h>
+
+/* Replies that never change are built once and shared, so that the
+ * common queries do not have to allocate.  The returned values are
+ * borrowed and never floating.
+ */
+void shim_replies_init (void);
+
+/* NULL for states that have no shared reply */
+GVariant *shim_reply_unit_file_state (const gchar *state);
+GVariant *shim_reply_no_changes (void);
+GVariant *shim_reply_enable (void);
+
+#endif /* _shim_replies_h_ */
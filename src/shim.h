@@ -0,0 +1,40 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _shim_h_
+#define _shim_h_
+
+/* Keep the shim from exiting on inactivity while there is work in
+ * progress.  Every shim_hold() must be balanced by a shim_release().
+ */
+void shim_hold (void);
+void shim_release (void);
+
+/* Set from SYSTEMD_SHIM_DRY_RUN at startup.  A dry run goes through all
+ * the motions but runs no helpers and changes nothing on the system, so
+ * the shim can be exercised by the benchmarks on a private bus.
+ */
+gboolean shim_is_dry_run (void);
+
+/* Called whenever a job is added or removed, so that changes to the
+ * NJobs and NInstalledJobs properties can be announced.
+ */
+void shim_jobs_changed (void);
+
+#endif /* _shim_h_ */
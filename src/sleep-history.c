@@ -0,0 +1,228 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "sleep-history.h"
+#include "state.h"
+
+#include <string.h>
+#include <time.h>
+
+struct _SleepRecord
+{
+  const gchar *kind;
+  gint64 realtime;
+  gint64 monotonic[N_SLEEP_MARKS];
+  gint64 boottime[N_SLEEP_MARKS];
+};
+
+static SleepHistory sleep_history;
+
+static GDBusConnection *sleep_connection;
+static GDBusInterfaceInfo *sleep_interface;
+
+static gint64
+sleep_clock_get (clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime (clock, &ts);
+
+  return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+SleepRecord *
+sleep_record_new (const gchar *kind)
+{
+  SleepRecord *record;
+
+  record = g_slice_new0 (SleepRecord);
+  record->kind = kind;
+  record->realtime = g_get_real_time ();
+  sleep_record_mark (record, SLEEP_MARK_REQUESTED);
+
+  return record;
+}
+
+/* May be called from the thread that puts the system to sleep, so that
+ * the marks around the write to /sys/power/state are as tight as they
+ * can be.
+ */
+void
+sleep_record_mark (SleepRecord *record,
+                   SleepMark    mark)
+{
+  record->monotonic[mark] = sleep_clock_get (CLOCK_MONOTONIC);
+  record->boottime[mark] = sleep_clock_get (CLOCK_BOOTTIME);
+}
+
+/* Marks that were never reached stay 0, e.g. when /sys/power/state
+ * can't be opened or pm-utils does the suspend; intervals involving
+ * them are reported as 0 rather than as the whole uptime.
+ */
+static gboolean
+sleep_record_has_marks (SleepRecord *record,
+                        SleepMark    from,
+                        SleepMark    to)
+{
+  return record->monotonic[from] != 0 && record->monotonic[to] != 0;
+}
+
+static guint64
+sleep_record_asleep (SleepRecord *record)
+{
+  gint64 suspended;
+
+  if (!sleep_record_has_marks (record, SLEEP_MARK_ENTERING, SLEEP_MARK_RESUMED))
+    return 0;
+
+  suspended = (record->boottime[SLEEP_MARK_RESUMED] - record->boottime[SLEEP_MARK_ENTERING]) -
+              (record->monotonic[SLEEP_MARK_RESUMED] - record->monotonic[SLEEP_MARK_ENTERING]);
+
+  return MAX (suspended, 0);
+}
+
+static guint64
+sleep_record_interval (SleepRecord *record,
+                       SleepMark    from,
+                       SleepMark    to)
+{
+  if (!sleep_record_has_marks (record, from, to))
+    return 0;
+
+  return MAX (record->monotonic[to] - record->monotonic[from], 0);
+}
+
+void
+sleep_record_resumed (SleepRecord *record)
+{
+  if (sleep_connection == NULL)
+    return;
+
+  g_dbus_connection_emit_signal (sleep_connection, NULL, "/org/freedesktop/systemd1", sleep_interface->name,
+                                 "Resumed", g_variant_new ("(st)", record->kind, sleep_record_asleep (record)),
+                                 NULL);
+}
+
+void
+sleep_record_finish (SleepRecord *record,
+                     gboolean     success)
+{
+  SleepHistoryEntry *entry;
+
+  sleep_record_mark (record, SLEEP_MARK_DONE);
+
+  entry = &sleep_history.entries[sleep_history.next];
+  memset (entry, 0, sizeof *entry);
+  g_strlcpy (entry->kind, record->kind, sizeof entry->kind);
+  entry->realtime = record->realtime;
+  entry->entry_usec = sleep_record_interval (record, SLEEP_MARK_REQUESTED, SLEEP_MARK_ENTERING);
+  entry->kernel_usec = sleep_record_interval (record, SLEEP_MARK_ENTERING, SLEEP_MARK_RESUMED);
+  entry->sleep_usec = sleep_record_asleep (record);
+  entry->resume_usec = sleep_record_interval (record, SLEEP_MARK_RESUMED, SLEEP_MARK_DONE);
+  entry->success = success;
+
+  sleep_history.next = (sleep_history.next + 1) % SLEEP_HISTORY_SIZE;
+  sleep_history.len = MIN (sleep_history.len + 1, SLEEP_HISTORY_SIZE);
+
+  g_slice_free (SleepRecord, record);
+
+  /* We are likely to exit on inactivity long before anybody asks */
+  shim_state_save ();
+}
+
+const SleepHistory *
+sleep_history_get (void)
+{
+  return &sleep_history;
+}
+
+/* Called with the history from the state file, which is not trusted
+ * any further than its layout.
+ */
+void
+sleep_history_restore (const SleepHistory *history)
+{
+  guint i;
+
+  if (history->next >= SLEEP_HISTORY_SIZE || history->len > SLEEP_HISTORY_SIZE)
+    return;
+
+  for (i = 0; i < SLEEP_HISTORY_SIZE; i++)
+    if (!memchr (history->entries[i].kind, '\0', sizeof history->entries[i].kind))
+      return;
+
+  sleep_history = *history;
+}
+
+/* Oldest first */
+static GVariant *
+sleep_history_build_reply (void)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(sxttttb))"));
+  g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(sxttttb)"));
+
+  for (i = 0; i < sleep_history.len; i++)
+    {
+      SleepHistoryEntry *entry;
+
+      entry = &sleep_history.entries[(sleep_history.next + SLEEP_HISTORY_SIZE - sleep_history.len + i) %
+                                     SLEEP_HISTORY_SIZE];
+      g_variant_builder_add (&builder, "(sxttttb)",
+                             entry->kind, entry->realtime,
+                             entry->entry_usec, entry->kernel_usec, entry->sleep_usec, entry->resume_usec,
+                             entry->success);
+    }
+
+  g_variant_builder_close (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+sleep_history_method_call (GDBusConnection       *connection,
+                           const gchar           *sender,
+                           const gchar           *object_path,
+                           const gchar           *interface_name,
+                           const gchar           *method_name,
+                           GVariant              *parameters,
+                           GDBusMethodInvocation *invocation,
+                           gpointer               user_data)
+{
+  g_assert_cmpstr (method_name, ==, "GetSleepHistory");
+
+  g_dbus_method_invocation_return_value (invocation, sleep_history_build_reply ());
+}
+
+void
+sleep_history_register (GDBusConnection    *connection,
+                        GDBusInterfaceInfo *sleep_iface)
+{
+  static const GDBusInterfaceVTable vtable = {
+    sleep_history_method_call
+  };
+
+  sleep_connection = connection;
+  sleep_interface = sleep_iface;
+
+  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", sleep_iface,
+                                     &vtable, NULL, NULL, NULL);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _sleep_history_h_
+#define _sleep_history_h_
+
+#include <gio/gio.h>
+
+/* Timing of suspend and hibernate, exported on the Shim.Sleep
+ * interface.  Each sleep is timestamped at the points below with both
+ * CLOCK_MONOTONIC and CLOCK_BOOTTIME.  Only the latter keeps counting
+ * while the system is asleep, so the difference between the two gives
+ * the time actually spent asleep.
+ */
+typedef enum
+{
+  SLEEP_MARK_REQUESTED,
+  SLEEP_MARK_ENTERING,  /* hooks have run; just before the kernel is asked */
+  SLEEP_MARK_RESUMED,   /* the kernel (or pm-utils) has returned */
+  SLEEP_MARK_DONE,      /* post hooks have run as well */
+  N_SLEEP_MARKS
+} SleepMark;
+
+typedef struct _SleepRecord SleepRecord;
+
+/* Only the most recent sleeps are kept.  The history is fixed-layout so
+ * that it can be kept in the state file across restarts of the shim.
+ */
+#define SLEEP_HISTORY_SIZE 16
+
+typedef struct
+{
+  gchar   kind[16];
+  gint64  realtime;
+  guint64 entry_usec;
+  guint64 kernel_usec;
+  guint64 sleep_usec;
+  guint64 resume_usec;
+  guint32 success;
+  guint32 padding;
+} SleepHistoryEntry;
+
+typedef struct
+{
+  SleepHistoryEntry entries[SLEEP_HISTORY_SIZE];
+  guint32 next;
+  guint32 len;
+} SleepHistory;
+
+const SleepHistory *sleep_history_get (void);
+void sleep_history_restore (const SleepHistory *history);
+
+SleepRecord *sleep_record_new (const gchar *kind);
+void sleep_record_mark (SleepRecord *record, SleepMark mark);
+
+/* Emits the Resumed signal.  Call this as soon as the system is back */
+void sleep_record_resumed (SleepRecord *record);
+
+/* Marks the sleep as done and moves it into the history */
+void sleep_record_finish (SleepRecord *record, gboolean success);
+
+void sleep_history_register (GDBusConnection *connection, GDBusInterfaceInfo *sleep_iface);
+
+#endif /* _sleep_history_h_ */
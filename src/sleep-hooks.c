@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "sleep-hooks.h"
+#include "launcher.h"
+#include "stats.h"
+
+#include <string.h>
+
+/* All hooks of a phase are started at once.  We wait for them until
+ * the deadline, but no longer: a hook that hangs must not keep the
+ * machine from going to sleep.  Hooks that are still running then are
+ * left to finish on their own.
+ */
+#define SLEEP_HOOK_TIMEOUT_SECONDS 10
+
+/* Earlier directories take precedence for hooks of the same name */
+static const gchar * const sleep_hook_dirs[] = {
+  SLEEP_HOOKS_DIR,
+  "/lib/systemd/system-sleep"
+};
+
+typedef struct
+{
+  guint pending;
+  guint timeout_id;
+  gboolean done;
+} SleepHooksData;
+
+typedef struct
+{
+  GTask *task;
+  gchar *name;
+  gint64 start_time;
+} SleepHook;
+
+static void
+sleep_hooks_data_free (gpointer user_data)
+{
+  g_slice_free (SleepHooksData, user_data);
+}
+
+gboolean
+sleep_hooks_enabled (void)
+{
+  return g_file_test (SLEEP_HOOKS_DIR, G_FILE_TEST_IS_DIR);
+}
+
+static void
+sleep_hooks_complete (GTask *task)
+{
+  SleepHooksData *data = g_task_get_task_data (task);
+
+  if (data->done)
+    return;
+
+  data->done = TRUE;
+
+  if (data->timeout_id)
+    g_source_remove (data->timeout_id);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+sleep_hooks_timeout (gpointer user_data)
+{
+  GTask *task = user_data;
+  SleepHooksData *data = g_task_get_task_data (task);
+
+  g_warning ("%u sleep hook(s) still running after %u seconds; not waiting any longer",
+             data->pending, SLEEP_HOOK_TIMEOUT_SECONDS);
+
+  data->timeout_id = 0;
+  sleep_hooks_complete (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+sleep_hook_done (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  SleepHook *hook = user_data;
+  SleepHooksData *data = g_task_get_task_data (hook->task);
+  GError *error = NULL;
+  gint64 usec;
+
+  usec = g_get_monotonic_time () - hook->start_time;
+  stats_record (STATS_SLEEP_HOOK, hook->name, usec);
+
+  if (!spawn_helper_finish (result, &error))
+    {
+      stats_record_error (STATS_SLEEP_HOOK, hook->name);
+      g_warning ("Sleep hook %s failed: %s", hook->name, error->message);
+      g_error_free (error);
+    }
+  else
+    g_debug ("Sleep hook %s took %" G_GINT64_FORMAT " usec", hook->name, usec);
+
+  if (--data->pending == 0)
+    sleep_hooks_complete (hook->task);
+
+  g_object_unref (hook->task);
+  g_free (hook->name);
+  g_slice_free (SleepHook, hook);
+}
+
+/* Fills hooks with name → path (NULL if masked) and returns the names
+ * in the order that the hooks are started.
+ */
+static GList *
+sleep_hooks_find (GHashTable *hooks)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sleep_hook_dirs); i++)
+    {
+      const gchar *name;
+      GDir *dir;
+
+      dir = g_dir_open (sleep_hook_dirs[i], 0, NULL);
+      if (dir == NULL)
+        continue;
+
+      while ((name = g_dir_read_name (dir)))
+        {
+          gchar *path;
+
+          if (g_hash_table_contains (hooks, name))
+            continue;
+
+          path = g_build_filename (sleep_hook_dirs[i], name, NULL);
+
+          /* A non-executable file masks the hook of the same name */
+          if (!g_file_test (path, G_FILE_TEST_IS_EXECUTABLE) || g_file_test (path, G_FILE_TEST_IS_DIR))
+            {
+              g_free (path);
+              path = NULL;
+            }
+
+          g_hash_table_insert (hooks, g_strdup (name), path);
+        }
+
+      g_dir_close (dir);
+    }
+
+  return g_list_sort (g_hash_table_get_keys (hooks), (GCompareFunc) strcmp);
+}
+
+/* Never fails: problems with individual hooks are only logged */
+void
+sleep_hooks_run (const gchar         *phase,
+                 const gchar         *kind,
+                 GAsyncReadyCallback  callback,
+                 gpointer             user_data)
+{
+  SleepHooksData *data;
+  GHashTable *hooks;
+  GList *names, *l;
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  data = g_slice_new0 (SleepHooksData);
+  g_task_set_task_data (task, data, sleep_hooks_data_free);
+
+  hooks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  names = sleep_hooks_find (hooks);
+
+  for (l = names; l; l = l->next)
+    {
+      const gchar *path = g_hash_table_lookup (hooks, l->data);
+      const gchar *argv[] = { path, phase, kind, NULL };
+      SleepHook *hook;
+
+      if (path == NULL)
+        continue;
+
+      hook = g_slice_new (SleepHook);
+      hook->task = g_object_ref (task);
+      hook->name = g_strdup_printf ("%s %s", phase, (gchar *) l->data);
+      hook->start_time = g_get_monotonic_time ();
+      data->pending++;
+
+      spawn_helper (argv, sleep_hook_done, hook);
+    }
+
+  g_list_free (names);
+  g_hash_table_unref (hooks);
+
+  if (data->pending == 0)
+    sleep_hooks_complete (task);
+  else
+    data->timeout_id = g_timeout_add_seconds (SLEEP_HOOK_TIMEOUT_SECONDS, sleep_hooks_timeout, task);
+
+  g_object_unref (task);
+}
+
+void
+sleep_hooks_run_finish (GAsyncResult *result)
+{
+  g_return_if_fail (g_task_is_valid (result, NULL));
+
+  g_task_propagate_boolean (G_TASK (result), NULL);
+}
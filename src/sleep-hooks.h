@@ -0,0 +1,37 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _sleep_hooks_h_
+#define _sleep_hooks_h_
+
+#include <gio/gio.h>
+
+/* Hooks are executables in SLEEP_HOOKS_DIR and in the systemd-sleep
+ * hook directory, called as "<hook> pre|post suspend|hibernate".  The
+ * shim runs them itself, instead of going through pm-utils, if
+ * SLEEP_HOOKS_DIR exists or pm-utils is not installed.
+ */
+#define SLEEP_HOOKS_DIR "/etc/systemd-shim/sleep.d"
+
+gboolean sleep_hooks_enabled (void);
+
+void sleep_hooks_run (const gchar *phase, const gchar *kind, GAsyncReadyCallback callback, gpointer user_data);
+void sleep_hooks_run_finish (GAsyncResult *result);
+
+#endif /* _sleep_hooks_h_ */
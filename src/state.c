@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "state.h"
+
+#include <gio/gio.h>
+
+#include "shim.h"
+#include "job.h"
+#include "virt.h"
+#include "sleep-history.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/* The shim exits after a few seconds without activity and is activated
+ * again on the next request.  A small fixed-layout record in /run keeps
+ * what it learnt across those restarts, so that a fresh instance
+ * behaves like a long-lived one without redoing any work.
+ *
+ * The record is only ever valid for the boot that wrote it.  Anything
+ * that looks wrong (size, magic, version, boot ID) is ignored and we
+ * start from scratch, which is always safe.
+ */
+
+#define STATE_DIR     "/run/systemd-shim"
+#define STATE_FILE    STATE_DIR "/state"
+#define BOOT_ID_FILE  "/proc/sys/kernel/random/boot_id"
+
+#define STATE_MAGIC   "SDSHIM\0\0"
+#define STATE_VERSION 2
+
+#define BOOT_ID_LEN   36
+
+enum
+{
+  STATE_FLAG_IN_SHUTDOWN = 1 << 0
+};
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 flags;
+  gchar   boot_id[BOOT_ID_LEN];
+  guint32 last_job_id;
+  gint32  virtualization;
+  gchar   virtualization_id[32];
+  SleepHistory sleep_history;
+} ShimStateRecord;
+
+/* detect_virtualization() hands out static strings, so the restored one
+ * has to live somewhere for the rest of the process.
+ */
+static gchar restored_virtualization_id[32];
+
+static gboolean
+shim_state_get_boot_id (gchar boot_id[BOOT_ID_LEN])
+{
+  gssize n;
+  gint fd;
+
+  fd = open (BOOT_ID_FILE, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
+
+  do
+    n = read (fd, boot_id, BOOT_ID_LEN);
+  while (n == -1 && errno == EINTR);
+
+  close (fd);
+
+  return n == BOOT_ID_LEN;
+}
+
+void
+shim_state_load (void)
+{
+  extern gboolean in_shutdown;
+  const ShimStateRecord *record;
+  gchar boot_id[BOOT_ID_LEN];
+  struct stat buf;
+  gpointer map;
+  gint fd;
+
+  if (shim_is_dry_run () || !shim_state_get_boot_id (boot_id))
+    return;
+
+  fd = open (STATE_FILE, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+
+  if (fstat (fd, &buf) != 0 || buf.st_size != sizeof (ShimStateRecord))
+    {
+      close (fd);
+      return;
+    }
+
+  map = mmap (NULL, sizeof (ShimStateRecord), PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return;
+
+  record = map;
+
+  if (memcmp (record->magic, STATE_MAGIC, sizeof record->magic) == 0 &&
+      record->version == STATE_VERSION &&
+      memcmp (record->boot_id, boot_id, BOOT_ID_LEN) == 0)
+    {
+      if (record->flags & STATE_FLAG_IN_SHUTDOWN)
+        in_shutdown = TRUE;
+
+      job_manager_set_last_id (record->last_job_id);
+
+      if (record->virtualization > 0 &&
+          memchr (record->virtualization_id, '\0', sizeof record->virtualization_id))
+        {
+          strcpy (restored_virtualization_id, record->virtualization_id);
+          detect_virtualization_seed (record->virtualization, restored_virtualization_id);
+        }
+      else if (record->virtualization == VIRTUALIZATION_NONE)
+        detect_virtualization_seed (VIRTUALIZATION_NONE, NULL);
+
+      sleep_history_restore (&record->sleep_history);
+    }
+
+  munmap (map, sizeof (ShimStateRecord));
+}
+
+void
+shim_state_save (void)
+{
+  extern gboolean in_shutdown;
+  ShimStateRecord record;
+  GError *error = NULL;
+  const gchar *id = NULL;
+
+  memset (&record, 0, sizeof record);
+
+  if (shim_is_dry_run () || !shim_state_get_boot_id (record.boot_id))
+    return;
+
+  memcpy (record.magic, STATE_MAGIC, sizeof record.magic);
+  record.version = STATE_VERSION;
+  record.flags = in_shutdown ? STATE_FLAG_IN_SHUTDOWN : 0;
+  record.last_job_id = job_manager_get_last_id ();
+  record.virtualization = detect_virtualization_cached (&id);
+  if (record.virtualization > 0)
+    g_strlcpy (record.virtualization_id, id, sizeof record.virtualization_id);
+  record.sleep_history = *sleep_history_get ();
+
+  /* g_file_set_contents() writes a temporary file and renames it over
+   * the old one, so a reader never sees a partial record.
+   */
+  if (g_mkdir_with_parents (STATE_DIR, 0755) != 0 ||
+      !g_file_set_contents (STATE_FILE, (const gchar *) &record, sizeof record, &error))
+    {
+      g_warning ("Unable to save state to " STATE_FILE ": %s",
+                 error ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+}
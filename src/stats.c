@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "stats.h"
+
+/* Bucket 0 holds samples below 2µs, bucket i (for i > 0) the ones from
+ * 2^i up to 2^(i+1) µs.  The last bucket also takes everything longer,
+ * from about half a minute up.
+ */
+#define N_BUCKETS 26
+
+typedef struct
+{
+  guint64 calls;
+  guint64 errors;
+  guint64 total_usec;
+  guint64 max_usec;
+  guint32 buckets[N_BUCKETS];
+} StatsEntry;
+
+static const gchar * const category_names[N_STATS_CATEGORIES] = {
+  [STATS_DISPATCH] = "dispatch",
+  [STATS_PROPERTY] = "property",
+  [STATS_UNIT_START] = "unit-start",
+  [STATS_UNIT_STOP] = "unit-stop",
+  [STATS_SPAWN] = "spawn",
+  [STATS_SLEEP_HOOK] = "sleep-hook"
+};
+
+/* name -> StatsEntry, one table per category.  Most names come from
+ * fixed sets (our methods, units and helpers).  Sleep hook names come
+ * from listing the hook directories, so that table has one entry per
+ * hook file ever seen by this process; only root can add those.
+ */
+static GHashTable *stats_tables[N_STATS_CATEGORIES];
+
+static StatsEntry *
+stats_get_entry (StatsCategory  category,
+                 const gchar   *name)
+{
+  StatsEntry *entry;
+
+  if (stats_tables[category] == NULL)
+    stats_tables[category] = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  entry = g_hash_table_lookup (stats_tables[category], name);
+
+  if (entry == NULL)
+    {
+      entry = g_new0 (StatsEntry, 1);
+      g_hash_table_insert (stats_tables[category], g_strdup (name), entry);
+    }
+
+  return entry;
+}
+
+void
+stats_record (StatsCategory  category,
+              const gchar   *name,
+              gint64         usec)
+{
+  StatsEntry *entry;
+  guint bucket;
+
+  if (usec < 0)
+    usec = 0;
+
+  entry = stats_get_entry (category, name);
+  entry->calls++;
+  entry->total_usec += usec;
+  entry->max_usec = MAX (entry->max_usec, (guint64) usec);
+
+  bucket = usec < 2 ? 0 : g_bit_storage (usec) - 1;
+  entry->buckets[MIN (bucket, N_BUCKETS - 1)]++;
+}
+
+void
+stats_record_error (StatsCategory  category,
+                    const gchar   *name)
+{
+  stats_get_entry (category, name)->errors++;
+}
+
+static GVariant *
+stats_build_reply (void)
+{
+  GVariantBuilder builder;
+  StatsCategory category;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ssttttau))"));
+  g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ssttttau)"));
+
+  for (category = 0; category < N_STATS_CATEGORIES; category++)
+    {
+      GHashTableIter iter;
+      gpointer key, value;
+
+      if (stats_tables[category] == NULL)
+        continue;
+
+      g_hash_table_iter_init (&iter, stats_tables[category]);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          StatsEntry *entry = value;
+
+          g_variant_builder_add (&builder, "(sstttt@au)",
+                                 category_names[category], key,
+                                 entry->calls, entry->errors, entry->total_usec, entry->max_usec,
+                                 g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, entry->buckets,
+                                                            N_BUCKETS, sizeof (guint32)));
+        }
+    }
+
+  g_variant_builder_close (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+stats_method_call (GDBusConnection       *connection,
+                   const gchar           *sender,
+                   const gchar           *object_path,
+                   const gchar           *interface_name,
+                   const gchar           *method_name,
+                   GVariant              *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer               user_data)
+{
+  if (g_str_equal (method_name, "GetStatistics"))
+    g_dbus_method_invocation_return_value (invocation, stats_build_reply ());
+
+  else if (g_str_equal (method_name, "Reset"))
+    {
+      StatsCategory category;
+
+      for (category = 0; category < N_STATS_CATEGORIES; category++)
+        if (stats_tables[category])
+          g_hash_table_remove_all (stats_tables[category]);
+
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+
+  else
+    g_assert_not_reached ();
+}
+
+void
+stats_register (GDBusConnection    *connection,
+                GDBusInterfaceInfo *debug_iface)
+{
+  static const GDBusInterfaceVTable vtable = {
+    stats_method_call
+  };
+
+  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", debug_iface,
+                                     &vtable, NULL, NULL, NULL);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _stats_h_
+#define _stats_h_
+
+#include <gio/gio.h>
+
+/* Latency statistics for the Shim.Debug interface.  Samples are kept
+ * per category and name (e.g. the method name for STATS_DISPATCH) in
+ * log2-sized buckets of microseconds.
+ */
+typedef enum
+{
+  STATS_DISPATCH,
+  STATS_PROPERTY,
+  STATS_UNIT_START,
+  STATS_UNIT_STOP,
+  STATS_SPAWN,
+  STATS_SLEEP_HOOK,
+  N_STATS_CATEGORIES
+} StatsCategory;
+
+#ifdef ENABLE_DEBUG_INTERFACE
+
+void stats_record (StatsCategory category, const gchar *name, gint64 usec);
+void stats_record_error (StatsCategory category, const gchar *name);
+void stats_register (GDBusConnection *connection, GDBusInterfaceInfo *debug_iface);
+
+#else
+
+static inline void stats_record (StatsCategory category, const gchar *name, gint64 usec) { }
+static inline void stats_record_error (StatsCategory category, const gchar *name) { }
+
+#endif /* ENABLE_DEBUG_INTERFACE */
+
+#endif /* _stats_h_ */
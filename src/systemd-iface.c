@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "systemd-iface.h"
+
+/* These are the structures that g_dbus_node_info_new_for_xml() would
+ * build, laid out at compile time.  A ref_count of -1 marks them as
+ * static, so GDBus never tries to free them.
+ *
+ * The arrays are file-scope compound literals, which have static
+ * storage duration just like named objects.
+ */
+
+#define ARG(name, signature) \
+  (&(GDBusArgInfo) { -1, (gchar *) name, (gchar *) signature, NULL })
+
+#define ARGS(...) \
+  ((GDBusArgInfo *[]) { __VA_ARGS__, NULL })
+
+#define METHOD(name, in_args, out_args) \
+  (&(GDBusMethodInfo) { -1, (gchar *) name, in_args, out_args, NULL })
+
+#define SIGNAL(name, args) \
+  (&(GDBusSignalInfo) { -1, (gchar *) name, args, NULL })
+
+#define PROPERTY(name, signature) \
+  (&(GDBusPropertyInfo) { -1, (gchar *) name, (gchar *) signature, \
+                          G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL })
+
+GDBusInterfaceInfo shim_manager_interface = {
+  -1, (gchar *) "org.freedesktop.systemd1.Manager",
+
+  (GDBusMethodInfo *[]) {
+    METHOD ("GetUnitFileState",
+            ARGS (ARG ("file", "s")),
+            ARGS (ARG ("state", "s"))),
+    METHOD ("DisableUnitFiles",
+            ARGS (ARG ("files", "as"), ARG ("runtime", "b")),
+            ARGS (ARG ("changes", "a(sss)"))),
+    METHOD ("EnableUnitFiles",
+            ARGS (ARG ("files", "as"), ARG ("runtime", "b"), ARG ("force", "b")),
+            ARGS (ARG ("carries_install_info", "b"), ARG ("changes", "a(sss)"))),
+    METHOD ("Reload", NULL, NULL),
+    METHOD ("StartUnit",
+            ARGS (ARG ("name", "s"), ARG ("mode", "s")),
+            ARGS (ARG ("job", "o"))),
+    METHOD ("StopUnit",
+            ARGS (ARG ("name", "s"), ARG ("mode", "s")),
+            ARGS (ARG ("job", "o"))),
+    METHOD ("GetUnit",
+            ARGS (ARG ("name", "s")),
+            ARGS (ARG ("unit", "o"))),
+    METHOD ("LoadUnit",
+            ARGS (ARG ("name", "s")),
+            ARGS (ARG ("unit", "o"))),
+    METHOD ("GetJob",
+            ARGS (ARG ("id", "u")),
+            ARGS (ARG ("job", "o"))),
+    METHOD ("Subscribe", NULL, NULL),
+    METHOD ("Unsubscribe", NULL, NULL),
+    METHOD ("ListUnits",
+            NULL,
+            ARGS (ARG ("units", "a(ssssssouso)"))),
+    METHOD ("ListUnitFiles",
+            NULL,
+            ARGS (ARG ("files", "a(ss)"))),
+    /* Not in systemd: GetUnitFileState for many units in one call */
+    METHOD ("GetUnitFileStates",
+            ARGS (ARG ("names", "as")),
+            ARGS (ARG ("states", "a(ss)"))),
+    NULL
+  },
+
+  (GDBusSignalInfo *[]) {
+    SIGNAL ("JobNew",
+            ARGS (ARG ("id", "u"), ARG ("job", "o"), ARG ("unit", "s"))),
+    SIGNAL ("JobRemoved",
+            ARGS (ARG ("id", "u"), ARG ("job", "o"), ARG ("unit", "s"), ARG ("result", "s"))),
+    NULL
+  },
+
+  (GDBusPropertyInfo *[]) {
+    PROPERTY ("Version", "s"),
+    PROPERTY ("Features", "s"),
+    PROPERTY ("Architecture", "s"),
+    PROPERTY ("Tainted", "s"),
+    PROPERTY ("Virtualization", "s"),
+    PROPERTY ("NJobs", "u"),
+    PROPERTY ("NInstalledJobs", "u"),
+    NULL
+  },
+
+  NULL
+};
+
+GDBusInterfaceInfo shim_job_interface = {
+  -1, (gchar *) "org.freedesktop.systemd1.Job",
+
+  (GDBusMethodInfo *[]) {
+    METHOD ("Cancel", NULL, NULL),
+    NULL
+  },
+
+  NULL,
+
+  (GDBusPropertyInfo *[]) {
+    PROPERTY ("Id", "u"),
+    PROPERTY ("Unit", "(so)"),
+    PROPERTY ("JobType", "s"),
+    PROPERTY ("State", "s"),
+    NULL
+  },
+
+  NULL
+};
+
+GDBusInterfaceInfo shim_unit_interface = {
+  -1, (gchar *) "org.freedesktop.systemd1.Unit",
+
+  (GDBusMethodInfo *[]) {
+    METHOD ("Start",
+            ARGS (ARG ("mode", "s")),
+            ARGS (ARG ("job", "o"))),
+    METHOD ("Stop",
+            ARGS (ARG ("mode", "s")),
+            ARGS (ARG ("job", "o"))),
+    NULL
+  },
+
+  NULL,
+
+  (GDBusPropertyInfo *[]) {
+    PROPERTY ("Id", "s"),
+    PROPERTY ("Description", "s"),
+    PROPERTY ("LoadState", "s"),
+    PROPERTY ("ActiveState", "s"),
+    PROPERTY ("SubState", "s"),
+    PROPERTY ("UnitFileState", "s"),
+    PROPERTY ("Job", "(uo)"),
+    NULL
+  },
+
+  NULL
+};
+
+/* Times are in µs.  Each history entry is (kind, wall clock time of
+ * the request, entry, kernel, asleep, resume, success): entry runs up
+ * to the point where the kernel is asked to sleep, kernel is the time
+ * spent awake in there, and resume covers everything after it.
+ */
+GDBusInterfaceInfo shim_sleep_interface = {
+  -1, (gchar *) "org.freedesktop.systemd1.Shim.Sleep",
+
+  (GDBusMethodInfo *[]) {
+    METHOD ("GetSleepHistory",
+            NULL,
+            ARGS (ARG ("history", "a(sxttttb)"))),
+    NULL
+  },
+
+  (GDBusSignalInfo *[]) {
+    SIGNAL ("Resumed",
+            ARGS (ARG ("kind", "s"), ARG ("asleep_usec", "t"))),
+    NULL
+  },
+
+  NULL,
+  NULL
+};
+
+/* Bucket i of a histogram counts the samples from 2^i to 2^(i+1) µs,
+ * except that bucket 0 starts at 0 and the last one has no upper bound.
+ */
+GDBusInterfaceInfo shim_debug_interface = {
+  -1, (gchar *) "org.freedesktop.systemd1.Shim.Debug",
+
+  (GDBusMethodInfo *[]) {
+    METHOD ("GetStatistics",
+            NULL,
+            ARGS (ARG ("statistics", "a(ssttttau)"))),
+    METHOD ("Reset", NULL, NULL),
+    NULL
+  },
+
+  NULL,
+  NULL,
+  NULL
+};
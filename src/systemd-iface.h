@@ -1,39 +1,34 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
 #ifndef _systemd_iface_h_
 #define _systemd_iface_h_
 
-const gchar *systemd_iface =
-  "<node>"
-   "<interface name='org.freedesktop.systemd1.Manager'>"
-    "<method name='GetUnitFileState'>"
-     "<arg name='file' type='s' direction='in'/>"
-     "<arg name='state' type='s' direction='out'/>"
-    "</method>"
-    "<method name='DisableUnitFiles'>"
-     "<arg name='files' type='as' direction='in'/>"
-     "<arg name='runtime' type='b' direction='in'/>"
-     "<arg name='changes' type='a(sss)' direction='out'/>"
-    "</method>"
-    "<method name='EnableUnitFiles'>"
-     "<arg name='files' type='as' direction='in'/>"
-     "<arg name='runtime' type='b' direction='in'/>"
-     "<arg name='force' type='b' direction='in'/>"
-     "<arg name='carries_install_info' type='b' direction='out'/>"
-     "<arg name='changes' type='a(sss)' direction='out'/>"
-    "</method>"
-    "<method name='Reload'/>"
-    "<method name='StartUnit'>"
-     "<arg name='name' type='s' direction='in'/>"
-     "<arg name='mode' type='s' direction='in'/>"
-     "<arg name='job' type='o' direction='out'/>"
-    "</method>"
-    "<method name='StopUnit'>"
-     "<arg name='name' type='s' direction='in'/>"
-     "<arg name='mode' type='s' direction='in'/>"
-     "<arg name='job' type='o' direction='out'/>"
-    "</method>"
-    "<method name='Reload'/>"
-    "<property name='Virtualization' type='s' access='read'/>"
-   "</interface>"
-  "</node>";
+#include <gio/gio.h>
+
+/* Introspection data for the interfaces that we export.  These are
+ * static, so there is no XML to parse when we are activated.
+ */
+extern GDBusInterfaceInfo shim_manager_interface;
+extern GDBusInterfaceInfo shim_job_interface;
+extern GDBusInterfaceInfo shim_unit_interface;
+extern GDBusInterfaceInfo shim_sleep_interface;
+extern GDBusInterfaceInfo shim_debug_interface;
 
-#endif
+#endif /* _systemd_iface_h_ */
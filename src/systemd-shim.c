@@ -19,22 +19,97 @@
 
 #include <gio/gio.h>
 
+#include "shim.h"
 #include "unit.h"
+#include "job.h"
+#include "state.h"
+#include "sleep-history.h"
+#include "stats.h"
+#include "probes.h"
 #include "virt.h"
+#include "shim-methods.h"
+#include "shim-properties.h"
+#include "shim-replies.h"
 
 #include "systemd-iface.h"
 
+#include <sys/utsname.h>
 #include <stdlib.h>
+#include <string.h>
+
+static guint inactivity_timeout;
+static guint hold_count;
+static gboolean dry_run;
+
+/* If SHIM_ACTIVATION_TRACE names a file, the monotonic time of each
+ * startup phase is written there once the first call has been
+ * dispatched.  This is read by the activation benchmark in bench/.
+ */
+typedef enum
+{
+  TRACE_MAIN,
+  TRACE_BUS_ACQUIRED,
+  TRACE_NAME_ACQUIRED,
+  TRACE_DISPATCH_START,
+  TRACE_DISPATCH_END,
+  N_TRACE_POINTS
+} TracePoint;
+
+static const gchar * const trace_point_names[N_TRACE_POINTS] = {
+  "main", "bus-acquired", "name-acquired", "dispatch-start", "dispatch-end"
+};
+
+static const gchar *trace_file;
+static gint64 trace_times[N_TRACE_POINTS];
+
+static void
+shim_trace (TracePoint point)
+{
+  GString *contents;
+  GError *error = NULL;
+  guint i;
+
+  if (G_LIKELY (trace_file == NULL))
+    return;
+
+  trace_times[point] = g_get_monotonic_time ();
+
+  if (point != TRACE_DISPATCH_END)
+    return;
+
+  contents = g_string_new (NULL);
+  for (i = 0; i < N_TRACE_POINTS; i++)
+    g_string_append_printf (contents, "%s %" G_GINT64_FORMAT "\n", trace_point_names[i], trace_times[i]);
+
+  if (!g_file_set_contents (trace_file, contents->str, contents->len, &error))
+    {
+      g_warning ("Unable to write activation trace: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_string_free (contents, TRUE);
+
+  /* Only the first call is interesting */
+  trace_file = NULL;
+}
 
 static gboolean
 exit_on_inactivity (gpointer user_data)
 {
   extern gboolean in_shutdown;
 
-  if (!in_shutdown)
+  inactivity_timeout = 0;
+
+  /* Work that is still in progress will restart the timer once it
+   * completes.
+   */
+  if (!in_shutdown && hold_count == 0)
     {
       GDBusConnection *system_bus;
 
+      /* Let the next instance pick up where we left off */
+      shim_state_save ();
+
       system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
       g_dbus_connection_flush_sync (system_bus, NULL, NULL);
       g_object_unref (system_bus);
@@ -48,99 +123,564 @@ exit_on_inactivity (gpointer user_data)
 static void
 had_activity (void)
 {
-  static gint inactivity_timeout;
-
   if (inactivity_timeout)
     g_source_remove (inactivity_timeout);
 
   inactivity_timeout = g_timeout_add (10000, exit_on_inactivity, NULL);
 }
 
+void
+shim_hold (void)
+{
+  hold_count++;
+}
+
+void
+shim_release (void)
+{
+  g_assert (hold_count > 0);
+  hold_count--;
+
+  had_activity ();
+}
+
+gboolean
+shim_is_dry_run (void)
+{
+  return dry_run;
+}
+
+/* Manager properties are served from this table.  The constant ones are
+ * filled in at startup, Virtualization once it has been detected, and
+ * the job counters are refreshed whenever a job comes or goes.
+ */
+static GVariant *property_values[N_SHIM_PROPERTIES];
+static GDBusConnection *shim_connection;
+static guint jobs_changed_id;
+
 static void
-shim_method_call (GDBusConnection       *connection,
-                  const gchar           *sender,
-                  const gchar           *object_path,
-                  const gchar           *interface_name,
-                  const gchar           *method_name,
-                  GVariant              *parameters,
-                  GDBusMethodInvocation *invocation,
-                  gpointer               user_data)
+shim_set_property (ShimProperty  property,
+                   GVariant     *value)
+{
+  if (property_values[property])
+    g_variant_unref (property_values[property]);
+
+  property_values[property] = g_variant_ref_sink (value);
+}
+
+/* Architecture names as systemd reports them */
+static const gchar *
+shim_get_architecture (void)
+{
+  static const struct {
+    const gchar *machine;
+    const gchar *name;
+  } architectures[] = {
+    { "x86_64",  "x86-64" },
+    { "i686",    "x86" },
+    { "i586",    "x86" },
+    { "i486",    "x86" },
+    { "i386",    "x86" },
+    { "aarch64", "arm64" },
+    { "armv",    "arm" },
+    { "ppc64le", "ppc64-le" },
+    { "ppc64",   "ppc64" },
+    { "ppc",     "ppc" },
+    { "s390x",   "s390x" },
+    { "s390",    "s390" },
+    { "mips64",  "mips64" },
+    { "mips",    "mips" },
+    { "sparc64", "sparc64" },
+    { "sparc",   "sparc" },
+    { "alpha",   "alpha" },
+    { "ia64",    "ia64" },
+    { "sh",      "sh" },
+  };
+  static struct utsname uts;
+  guint i;
+
+  if (uname (&uts) < 0)
+    return "";
+
+  /* Prefix match, so that armv7l and mips64el are covered */
+  for (i = 0; i < G_N_ELEMENTS (architectures); i++)
+    if (g_str_has_prefix (uts.machine, architectures[i].machine))
+      return architectures[i].name;
+
+  return uts.machine;
+}
+
+static void
+shim_build_properties (void)
+{
+  shim_set_property (SHIM_PROPERTY_VERSION, g_variant_new_string (PACKAGE_VERSION));
+  shim_set_property (SHIM_PROPERTY_FEATURES, g_variant_new_string (""));
+  shim_set_property (SHIM_PROPERTY_ARCHITECTURE, g_variant_new_string (shim_get_architecture ()));
+  shim_set_property (SHIM_PROPERTY_TAINTED, g_variant_new_string (""));
+  shim_set_property (SHIM_PROPERTY_N_JOBS, g_variant_new_uint32 (job_manager_get_n_jobs ()));
+  shim_set_property (SHIM_PROPERTY_N_INSTALLED_JOBS, g_variant_new_uint32 (job_manager_get_last_id ()));
+}
+
+static gboolean
+shim_emit_jobs_changed (gpointer user_data)
 {
+  GVariantBuilder changed;
+
+  jobs_changed_id = 0;
+
+  shim_set_property (SHIM_PROPERTY_N_JOBS, g_variant_new_uint32 (job_manager_get_n_jobs ()));
+  shim_set_property (SHIM_PROPERTY_N_INSTALLED_JOBS, g_variant_new_uint32 (job_manager_get_last_id ()));
+
+  g_variant_builder_init (&changed, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_add (&changed, "{sv}", "NJobs", property_values[SHIM_PROPERTY_N_JOBS]);
+  g_variant_builder_add (&changed, "{sv}", "NInstalledJobs", property_values[SHIM_PROPERTY_N_INSTALLED_JOBS]);
+
+  g_dbus_connection_emit_signal (shim_connection, NULL, "/org/freedesktop/systemd1",
+                                 "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                 g_variant_new ("(sa{sv}as)", shim_manager_interface.name, &changed, NULL),
+                                 NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* A burst of jobs results in a single PropertiesChanged signal, sent
+ * once the main loop is idle again.
+ */
+void
+shim_jobs_changed (void)
+{
+  if (jobs_changed_id == 0)
+    jobs_changed_id = g_idle_add (shim_emit_jobs_changed, NULL);
+}
+
+static void
+shim_return_unit_file_state (GDBusMethodInvocation *invocation,
+                             const gchar           *state)
+{
+  GVariant *reply;
+
+  reply = shim_reply_unit_file_state (state);
+  if (reply == NULL)
+    reply = g_variant_new ("(s)", state);
+
+  g_dbus_method_invocation_return_value (invocation, reply);
+}
+
+static void
+shim_return_error (GDBusMethodInvocation *invocation,
+                   GError                *error)
+{
+  stats_record_error (STATS_DISPATCH, g_dbus_method_invocation_get_method_name (invocation));
+  g_dbus_method_invocation_return_gerror (invocation, error);
+  g_error_free (error);
+}
+
+static void
+shim_got_unit_file_state (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  GDBusMethodInvocation *invocation = user_data;
   GError *error = NULL;
+  const gchar *state;
 
-  if (g_str_equal (method_name, "GetUnitFileState"))
-    {
-      Unit *unit;
+  state = unit_get_state_finish ((Unit *) source, result, &error);
 
-      unit = lookup_unit (parameters, &error);
+  if (state)
+    shim_return_unit_file_state (invocation, state);
+  else
+    shim_return_error (invocation, error);
 
-      if (unit)
-        {
-          g_dbus_method_invocation_return_value (invocation,
-                                                 g_variant_new ("(s)", unit_get_state (unit)));
-          g_object_unref (unit);
-          goto success;
-        }
-    }
+  shim_release ();
+}
+
+static void
+shim_enqueue_job (GVariant              *parameters,
+                  GDBusMethodInvocation *invocation,
+                  JobType                type)
+{
+  const gchar *unit_name;
+  const gchar *mode_name;
+  GError *error = NULL;
+  JobMode mode;
+  Unit *unit;
+  Job *job;
 
-  else if (g_str_equal (method_name, "DisableUnitFiles"))
+  g_variant_get (parameters, "(&s&s)", &unit_name, &mode_name);
+
+  if (!job_mode_from_string (mode_name, &mode, &error) ||
+      !(unit = lookup_unit (parameters, &error)) ||
+      !(job = job_enqueue (unit, unit_name, type, mode, &error)))
     {
-      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a(sss))", NULL));
-      goto success;
+      shim_return_error (invocation, error);
+      return;
     }
 
-  else if (g_str_equal (method_name, "EnableUnitFiles"))
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job_get_path (job)));
+}
+
+static void
+shim_get_unit_file_state (GDBusConnection       *connection,
+                          const gchar           *sender,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation)
+{
+  GError *error = NULL;
+  const gchar *state;
+  Unit *unit;
+
+  unit = lookup_unit (parameters, &error);
+
+  if (unit == NULL)
     {
-      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(ba(sss))", TRUE, NULL));
-      goto success;
+      shim_return_error (invocation, error);
+      return;
     }
 
-  else if (g_str_equal (method_name, "Reload"))
+  /* Fast path for units that know their state without doing I/O */
+  state = unit_peek_state (unit);
+  if (state)
     {
-      g_dbus_method_invocation_return_value (invocation, NULL);
-      goto success;
+      shim_return_unit_file_state (invocation, state);
+      return;
     }
 
-  else if (g_str_equal (method_name, "StopUnit"))
+  shim_hold ();
+  unit_get_state (unit, shim_got_unit_file_state, invocation);
+}
+
+static void
+shim_disable_unit_files (GDBusConnection       *connection,
+                         const gchar           *sender,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation)
+{
+  g_dbus_method_invocation_return_value (invocation, shim_reply_no_changes ());
+}
+
+static void
+shim_enable_unit_files (GDBusConnection       *connection,
+                        const gchar           *sender,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation)
+{
+  g_dbus_method_invocation_return_value (invocation, shim_reply_enable ());
+}
+
+static void
+shim_reload (GDBusConnection       *connection,
+             const gchar           *sender,
+             GVariant              *parameters,
+             GDBusMethodInvocation *invocation)
+{
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static void
+shim_stop_unit (GDBusConnection       *connection,
+                const gchar           *sender,
+                GVariant              *parameters,
+                GDBusMethodInvocation *invocation)
+{
+  shim_enqueue_job (parameters, invocation, JOB_STOP);
+}
+
+static void
+shim_start_unit (GDBusConnection       *connection,
+                 const gchar           *sender,
+                 GVariant              *parameters,
+                 GDBusMethodInvocation *invocation)
+{
+  shim_enqueue_job (parameters, invocation, JOB_START);
+}
+
+/* ListUnits, ListUnitFiles and GetUnitFileStates all report on many
+ * units at once.  The states are resolved in a single batch, and the
+ * reply is built once all of them are known.
+ */
+typedef struct
+{
+  GDBusMethodInvocation *invocation;
+  ShimMethod method;
+  GPtrArray *names;
+  GPtrArray *units;
+} ShimUnitQuery;
+
+static void
+shim_unit_query_add (const gchar *unit_name,
+                     Unit        *unit,
+                     gpointer     user_data)
+{
+  ShimUnitQuery *query = user_data;
+
+  g_ptr_array_add (query->names, (gpointer) unit_name);
+  g_ptr_array_add (query->units, unit);
+}
+
+static void
+shim_unit_query_free (ShimUnitQuery *query)
+{
+  g_ptr_array_unref (query->names);
+  g_ptr_array_unref (query->units);
+  g_slice_free (ShimUnitQuery, query);
+}
+
+static void
+shim_add_unit_row (GVariantBuilder *builder,
+                   const gchar     *unit_name,
+                   Unit            *unit,
+                   const gchar     *state)
+{
+  const gchar *active_state;
+  const gchar *sub_state;
+  gchar *path;
+  Job *job;
+
+  path = unit_name_to_path (unit_name);
+  job = job_manager_get_unit_job (unit);
+  unit_state_get_active (state, &active_state, &sub_state);
+
+  g_variant_builder_add (builder, "(ssssssouso)",
+                         unit_name, unit_name, "loaded", active_state, sub_state, "", path,
+                         job ? job_get_id (job) : 0,
+                         job ? job_get_type_string (job) : "",
+                         job ? job_get_path (job) : "/");
+  g_free (path);
+}
+
+static void
+shim_got_unit_states (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  ShimUnitQuery *query = user_data;
+  GVariantBuilder builder;
+  GHashTable *states;
+  guint i;
+
+  states = unit_get_states_finish (result, NULL);
+
+  switch (query->method)
     {
-      Unit *unit;
+    case SHIM_METHOD_LIST_UNITS:
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ssssssouso))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ssssssouso)"));
+      for (i = 0; i < query->names->len; i++)
+        {
+          Unit *unit = g_ptr_array_index (query->units, i);
+
+          shim_add_unit_row (&builder, g_ptr_array_index (query->names, i), unit,
+                             g_hash_table_lookup (states, unit));
+        }
+      break;
 
-      unit = lookup_unit (parameters, &error);
+    case SHIM_METHOD_LIST_UNIT_FILES:
+      /* The shim has no unit files; report where systemd would keep them */
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ss))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ss)"));
+      for (i = 0; i < query->names->len; i++)
+        {
+          gchar *path;
+
+          path = g_build_filename ("/lib/systemd/system", g_ptr_array_index (query->names, i), NULL);
+          g_variant_builder_add (&builder, "(ss)", path,
+                                 g_hash_table_lookup (states, g_ptr_array_index (query->units, i)));
+          g_free (path);
+        }
+      break;
 
-      if (unit)
+    default:
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ss))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ss)"));
+      for (i = 0; i < query->names->len; i++)
         {
-          unit_stop (unit);
-          g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/"));
-          g_object_unref (unit);
-          goto success;
+          Unit *unit = g_ptr_array_index (query->units, i);
+
+          /* Unknown names get an empty state rather than failing the
+           * whole batch.
+           */
+          g_variant_builder_add (&builder, "(ss)", g_ptr_array_index (query->names, i),
+                                 unit ? g_hash_table_lookup (states, unit) : "");
         }
+      break;
     }
 
-  else if (g_str_equal (method_name, "StartUnit"))
+  g_variant_builder_close (&builder);
+  g_dbus_method_invocation_return_value (query->invocation, g_variant_builder_end (&builder));
+
+  g_hash_table_unref (states);
+  shim_unit_query_free (query);
+  shim_release ();
+}
+
+static void
+shim_query_units (GVariant              *parameters,
+                  GDBusMethodInvocation *invocation,
+                  ShimMethod             method)
+{
+  ShimUnitQuery *query;
+
+  query = g_slice_new (ShimUnitQuery);
+  query->invocation = invocation;
+  query->method = method;
+  query->names = g_ptr_array_new ();
+  query->units = g_ptr_array_new ();
+
+  if (method == SHIM_METHOD_GET_UNIT_FILE_STATES)
     {
-      Unit *unit;
+      const gchar *unit_name;
+      GVariantIter *iter;
+
+      /* The names point into parameters, which the invocation keeps */
+      g_variant_get (parameters, "(as)", &iter);
+      while (g_variant_iter_next (iter, "&s", &unit_name))
+        shim_unit_query_add (unit_name, lookup_unit_by_name (unit_name, NULL), query);
+      g_variant_iter_free (iter);
+    }
+  else
+    unit_registry_foreach (shim_unit_query_add, query);
+
+  shim_hold ();
+  unit_get_states (query->units, shim_got_unit_states, query);
+}
 
-      unit = lookup_unit (parameters, &error);
+static void
+shim_list_units (GDBusConnection       *connection,
+                 const gchar           *sender,
+                 GVariant              *parameters,
+                 GDBusMethodInvocation *invocation)
+{
+  shim_query_units (parameters, invocation, SHIM_METHOD_LIST_UNITS);
+}
 
-      if (unit)
-        {
-          unit_start (unit);
-          g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/"));
-          g_dbus_connection_emit_signal (connection, sender, "/org/freedesktop/systemd1",
-                                         "org.freedesktop.systemd1.Manager", "JobRemoved",
-                                         g_variant_new ("(uoss)", 0, "/", "", ""), NULL);
-          g_object_unref (unit);
-          goto success;
-        }
+static void
+shim_list_unit_files (GDBusConnection       *connection,
+                      const gchar           *sender,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation)
+{
+  shim_query_units (parameters, invocation, SHIM_METHOD_LIST_UNIT_FILES);
+}
+
+static void
+shim_get_unit_file_states (GDBusConnection       *connection,
+                           const gchar           *sender,
+                           GVariant              *parameters,
+                           GDBusMethodInvocation *invocation)
+{
+  shim_query_units (parameters, invocation, SHIM_METHOD_GET_UNIT_FILE_STATES);
+}
+
+/* Units are always loaded as far as clients can tell, so GetUnit and
+ * LoadUnit are the same thing.
+ */
+static void
+shim_get_unit (GDBusConnection       *connection,
+               const gchar           *sender,
+               GVariant              *parameters,
+               GDBusMethodInvocation *invocation)
+{
+  const gchar *unit_name;
+  GError *error = NULL;
+  const gchar *path;
+
+  g_variant_get (parameters, "(&s)", &unit_name);
+
+  path = unit_objects_get_path (unit_name, &error);
+
+  if (path == NULL)
+    {
+      shim_return_error (invocation, error);
+      return;
+    }
+
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", path));
+}
+
+static void
+shim_get_job (GDBusConnection       *connection,
+              const gchar           *sender,
+              GVariant              *parameters,
+              GDBusMethodInvocation *invocation)
+{
+  guint32 id;
+  Job *job;
+
+  g_variant_get (parameters, "(u)", &id);
+
+  job = job_manager_lookup (id);
+
+  if (job == NULL)
+    {
+      shim_return_error (invocation, g_error_new (G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT,
+                                                  "Unknown job: %u", id));
+      return;
     }
 
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job_get_path (job)));
+}
+
+typedef void (* ShimMethodHandler) (GDBusConnection       *connection,
+                                    const gchar           *sender,
+                                    GVariant              *parameters,
+                                    GDBusMethodInvocation *invocation);
+
+static const ShimMethodHandler shim_method_handlers[N_SHIM_METHODS] = {
+  [SHIM_METHOD_GET_UNIT_FILE_STATE] = shim_get_unit_file_state,
+  [SHIM_METHOD_DISABLE_UNIT_FILES] = shim_disable_unit_files,
+  [SHIM_METHOD_ENABLE_UNIT_FILES] = shim_enable_unit_files,
+  [SHIM_METHOD_RELOAD] = shim_reload,
+  [SHIM_METHOD_START_UNIT] = shim_start_unit,
+  [SHIM_METHOD_STOP_UNIT] = shim_stop_unit,
+  /* Signals are always broadcast, so there is nothing to (un)subscribe */
+  [SHIM_METHOD_SUBSCRIBE] = shim_reload,
+  [SHIM_METHOD_UNSUBSCRIBE] = shim_reload,
+  [SHIM_METHOD_LIST_UNITS] = shim_list_units,
+  [SHIM_METHOD_LIST_UNIT_FILES] = shim_list_unit_files,
+  [SHIM_METHOD_GET_UNIT_FILE_STATES] = shim_get_unit_file_states,
+  [SHIM_METHOD_GET_UNIT] = shim_get_unit,
+  [SHIM_METHOD_LOAD_UNIT] = shim_get_unit,
+  [SHIM_METHOD_GET_JOB] = shim_get_job
+};
+
+static void
+shim_method_call (GDBusConnection       *connection,
+                  const gchar           *sender,
+                  const gchar           *object_path,
+                  const gchar           *interface_name,
+                  const gchar           *method_name,
+                  GVariant              *parameters,
+                  GDBusMethodInvocation *invocation,
+                  gpointer               user_data)
+{
+  const struct ShimMethodEntry *entry;
+  gint64 start;
+
+  /* State queries may have to wait for helper programs, and unit
+   * operations are run as jobs.  Either way the main loop stays free to
+   * serve other callers in the meantime.
+   */
+  shim_trace (TRACE_DISPATCH_START);
+  SHIM_PROBE1 (method__entry, method_name);
+  start = g_get_monotonic_time ();
+
+  entry = shim_method_lookup (method_name, strlen (method_name));
+
+  if (entry)
+    {
+      shim_method_handlers[entry->method] (connection, sender, parameters, invocation);
+      stats_record (STATS_DISPATCH, entry->name, g_get_monotonic_time () - start);
+    }
   else
-    g_assert_not_reached ();
+    {
+      stats_record_error (STATS_DISPATCH, "(unknown)");
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                             "Unknown method: %s", method_name);
+    }
 
-  g_dbus_method_invocation_return_gerror (invocation, error);
-  g_error_free (error);
+  SHIM_PROBE2 (method__return, method_name, g_get_monotonic_time () - start);
+  shim_trace (TRACE_DISPATCH_END);
 
-success:
   had_activity ();
 }
 
@@ -153,15 +693,51 @@ shim_get_property (GDBusConnection  *connection,
                    GError          **error,
                    gpointer          user_data)
 {
+  const struct ShimPropertyEntry *entry;
   const gchar *id = "";
+  gboolean was_cached;
+  GVariant *value;
+  gint64 start;
 
   had_activity ();
 
-  g_assert_cmpstr (property_name, ==, "Virtualization");
+  SHIM_PROBE1 (property__entry, property_name);
+  start = g_get_monotonic_time ();
+
+  /* GDBus has already checked the name against the interface info, and
+   * answers GetAll by calling here once per property.
+   */
+  entry = shim_property_lookup (property_name, strlen (property_name));
+  g_assert (entry != NULL);
+
+  if (property_values[entry->property])
+    {
+      value = g_variant_ref (property_values[entry->property]);
+      stats_record (STATS_PROPERTY, property_name, g_get_monotonic_time () - start);
+      SHIM_PROBE2 (property__return, property_name, g_get_monotonic_time () - start);
+
+      return value;
+    }
+
+  g_assert (entry->property == SHIM_PROPERTY_VIRTUALIZATION);
 
+  was_cached = detect_virtualization_cached (NULL) >= 0;
   detect_virtualization (&id);
+  stats_record (STATS_PROPERTY, property_name, g_get_monotonic_time () - start);
 
-  return g_variant_new ("s", id);
+  /* Save a fresh result right away rather than at idle exit, so that
+   * no other instance in this boot has to probe again even if we get
+   * killed.  Failures are not kept, so the next read tries again.
+   */
+  if (detect_virtualization_cached (NULL) >= 0)
+    {
+      shim_set_property (SHIM_PROPERTY_VIRTUALIZATION, g_variant_new_string (id));
+      if (!was_cached)
+        shim_state_save ();
+    }
+  SHIM_PROBE2 (property__return, property_name, g_get_monotonic_time () - start);
+
+  return g_variant_new_string (id);
 }
 
 static void
@@ -173,13 +749,36 @@ shim_bus_acquired (GDBusConnection *connection,
     shim_method_call,
     shim_get_property,
   };
-  GDBusInterfaceInfo *iface;
-  GDBusNodeInfo *node;
 
-  node = g_dbus_node_info_new_for_xml (systemd_iface, NULL);
-  iface = g_dbus_node_info_lookup_interface (node, "org.freedesktop.systemd1.Manager");
-  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", iface, &vtable, NULL, NULL, NULL);
-  g_dbus_node_info_unref (node);
+  shim_trace (TRACE_BUS_ACQUIRED);
+
+  shim_connection = connection;
+
+  /* Lets GDBus find methods and properties by hash instead of walking
+   * the arrays on every incoming call.
+   */
+  g_dbus_interface_info_cache_build (&shim_manager_interface);
+  g_dbus_interface_info_cache_build (&shim_job_interface);
+  g_dbus_interface_info_cache_build (&shim_unit_interface);
+  g_dbus_interface_info_cache_build (&shim_sleep_interface);
+
+  g_dbus_connection_register_object (connection, "/org/freedesktop/systemd1", &shim_manager_interface,
+                                     &vtable, NULL, NULL, NULL);
+  job_manager_init (connection, &shim_job_interface);
+  unit_objects_init (connection, &shim_unit_interface);
+  sleep_history_register (connection, &shim_sleep_interface);
+
+#ifdef ENABLE_DEBUG_INTERFACE
+  stats_register (connection, &shim_debug_interface);
+#endif
+}
+
+static void
+shim_name_acquired (GDBusConnection *connection,
+                    const gchar     *name,
+                    gpointer         user_data)
+{
+  shim_trace (TRACE_NAME_ACQUIRED);
 }
 
 static void
@@ -194,11 +793,20 @@ shim_name_lost (GDBusConnection *connection,
 int
 main (void)
 {
+  trace_file = g_getenv ("SHIM_ACTIVATION_TRACE");
+  shim_trace (TRACE_MAIN);
+
+  dry_run = g_getenv ("SYSTEMD_SHIM_DRY_RUN") != NULL;
+
+  shim_state_load ();
+  shim_replies_init ();
+  shim_build_properties ();
+
   g_bus_own_name (G_BUS_TYPE_SYSTEM,
                   "org.freedesktop.systemd1",
                   G_BUS_NAME_OWNER_FLAGS_NONE,
                   shim_bus_acquired,
-                  NULL, /* name_acquired */
+                  shim_name_acquired,
                   shim_name_lost,
                   NULL, NULL);
 
@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _unit_module_h_
+#define _unit_module_h_
+
+#include "unit.h"
+
+/* Unit backends can also live in loadable modules in UNIT_MODULE_DIR.
+ * Next to each module is a manifest, <module>.units, listing the unit
+ * names it handles:
+ *
+ *   [Unit Module]
+ *   Module=foo.so
+ *   Units=foo.service;foo-helper.service;
+ *
+ * Nothing is read until a unit name misses both the built-in table and
+ * the units.d mappings; the manifests are scanned then, once, and a
+ * module is only opened the first time one of its units is looked up.
+ * Units defined in modules subclass UNIT_TYPE, just like the built-in
+ * ones.  This header and unit.h are installed, and the systemd-shim
+ * pkg-config file gives their location and UNIT_MODULE_DIR as
+ * unitmoduledir; tests/test-unit-module.c is a minimal module.
+ *
+ * A module exports the two symbols below.  shim_unit_module_get() is
+ * called once per unit name and may return NULL if the unit is not
+ * available on this system; it will then be asked again next time.
+ */
+#define UNIT_MODULE_ABI_VERSION 1
+
+typedef Unit * (* UnitModuleGetFunc) (const gchar *unit_name);
+
+#define UNIT_MODULE_ABI_SYMBOL "shim_unit_module_abi"
+#define UNIT_MODULE_GET_SYMBOL "shim_unit_module_get"
+
+Unit *unit_modules_lookup (const gchar *unit_name);
+void unit_modules_foreach (UnitForeachFunc func, gpointer user_data);
+
+#endif /* _unit_module_h_ */
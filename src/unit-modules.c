@@ -0,0 +1,205 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "unit-module.h"
+#include "probes.h"
+
+#include <gmodule.h>
+
+#define UNIT_MODULE_GROUP     "Unit Module"
+#define UNIT_MODULE_MANIFEST  ".units"
+
+typedef struct
+{
+  gchar *path;
+  gboolean tried;
+  UnitModuleGetFunc get;
+} UnitModule;
+
+/* unit name → UnitModule, filled from the manifests on the first miss */
+static GHashTable *unit_module_names;
+
+/* unit name → Unit, for the units that modules have handed out */
+static GHashTable *unit_module_units;
+
+/* Test builds can load modules that are not installed yet, e.g. the
+ * test module in the build tree.  The real shim runs as root and only
+ * ever loads code from UNIT_MODULE_DIR.
+ */
+static const gchar *
+unit_modules_get_dir (void)
+{
+#ifdef SHIM_TESTING
+  const gchar *dir;
+
+  dir = g_getenv ("SYSTEMD_SHIM_UNIT_MODULE_DIR");
+  if (dir)
+    return dir;
+#endif
+
+  return UNIT_MODULE_DIR;
+}
+
+static void
+unit_modules_read_manifest (const gchar *manifest)
+{
+  GError *error = NULL;
+  GKeyFile *key_file;
+  UnitModule *module;
+  gchar *module_name;
+  gchar **units;
+  guint i;
+
+  key_file = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (key_file, manifest, G_KEY_FILE_NONE, &error) ||
+      !(module_name = g_key_file_get_string (key_file, UNIT_MODULE_GROUP, "Module", &error)))
+    {
+      g_warning ("Ignoring unit module manifest %s: %s", manifest, error->message);
+      g_error_free (error);
+      g_key_file_free (key_file);
+      return;
+    }
+
+  units = g_key_file_get_string_list (key_file, UNIT_MODULE_GROUP, "Units", NULL, NULL);
+  g_key_file_free (key_file);
+
+  /* Modules are never unloaded, so neither is their entry */
+  module = g_slice_new0 (UnitModule);
+  module->path = g_build_filename (unit_modules_get_dir (), module_name, NULL);
+  g_free (module_name);
+
+  for (i = 0; units && units[i]; i++)
+    {
+      /* The first manifest to claim a name wins */
+      if (g_hash_table_contains (unit_module_names, units[i]))
+        g_warning ("Unit %s is claimed by more than one module; ignoring %s", units[i], manifest);
+      else
+        g_hash_table_insert (unit_module_names, g_strdup (units[i]), module);
+    }
+
+  g_strfreev (units);
+}
+
+static void
+unit_modules_scan (void)
+{
+  const gchar *name;
+  GDir *dir;
+
+  unit_module_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  unit_module_units = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  dir = g_dir_open (unit_modules_get_dir (), 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)))
+    if (g_str_has_suffix (name, UNIT_MODULE_MANIFEST))
+      {
+        gchar *manifest;
+
+        manifest = g_build_filename (unit_modules_get_dir (), name, NULL);
+        unit_modules_read_manifest (manifest);
+        g_free (manifest);
+      }
+
+  g_dir_close (dir);
+}
+
+static gboolean
+unit_module_load (UnitModule *module)
+{
+  const guint32 *abi;
+  GModule *handle;
+
+  if (module->tried)
+    return module->get != NULL;
+
+  /* A module that fails to load is not retried */
+  module->tried = TRUE;
+
+  SHIM_PROBE1 (module__load__entry, module->path);
+
+  handle = g_module_open (module->path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+
+  if (handle == NULL)
+    g_warning ("Unable to load unit module: %s", g_module_error ());
+
+  else if (!g_module_symbol (handle, UNIT_MODULE_ABI_SYMBOL, (gpointer *) &abi) ||
+           *abi != UNIT_MODULE_ABI_VERSION ||
+           !g_module_symbol (handle, UNIT_MODULE_GET_SYMBOL, (gpointer *) &module->get))
+    {
+      g_warning ("%s is not a unit module for this version of the shim", module->path);
+      module->get = NULL;
+      g_module_close (handle);
+    }
+
+  else
+    /* The module defines GTypes, which can never go away */
+    g_module_make_resident (handle);
+
+  SHIM_PROBE2 (module__load__return, module->path, module->get != NULL);
+
+  return module->get != NULL;
+}
+
+/* Called for names that are not in the built-in table */
+Unit *
+unit_modules_lookup (const gchar *unit_name)
+{
+  UnitModule *module;
+  Unit *unit;
+
+  if (unit_module_names == NULL)
+    unit_modules_scan ();
+
+  unit = g_hash_table_lookup (unit_module_units, unit_name);
+  if (unit)
+    return unit;
+
+  module = g_hash_table_lookup (unit_module_names, unit_name);
+  if (module == NULL || !unit_module_load (module))
+    return NULL;
+
+  /* Like the built-in units, these live for the rest of the process */
+  unit = module->get (unit_name);
+  if (unit)
+    g_hash_table_insert (unit_module_units, g_strdup (unit_name), unit);
+
+  return unit;
+}
+
+/* Only visits the units that have been looked up so far, so that
+ * listing units does not load every module.
+ */
+void
+unit_modules_foreach (UnitForeachFunc func,
+                      gpointer        user_data)
+{
+  GHashTableIter iter;
+  gpointer name, unit;
+
+  if (unit_module_units == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, unit_module_units);
+  while (g_hash_table_iter_next (&iter, &name, &unit))
+    func (name, unit, user_data);
+}
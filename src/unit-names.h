@@ -0,0 +1,51 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _unit_names_h_
+#define _unit_names_h_
+
+#include <stddef.h>
+
+typedef enum
+{
+  UNIT_NTPD,
+  UNIT_SUSPEND,
+  UNIT_HIBERNATE,
+  UNIT_REBOOT,
+  UNIT_POWEROFF,
+  N_UNIT_IDS
+} UnitId;
+
+/* The unit name table is generated from unit-names.gperf.  Aliases
+ * simply map to the same UnitId.
+ */
+struct UnitNameEntry
+{
+  const char *name;
+  UnitId id;
+};
+
+const struct UnitNameEntry *unit_name_lookup (const char *str, GPERF_LEN_TYPE len);
+
+/* Calls func for every entry in the table, aliases included, in no
+ * particular order.
+ */
+void unit_name_foreach (void (* func) (const struct UnitNameEntry *entry, void *user_data), void *user_data);
+
+#endif /* _unit_names_h_ */
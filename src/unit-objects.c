@@ -0,0 +1,346 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "unit.h"
+#include "job.h"
+#include "shim.h"
+
+/* Per-unit objects live in a subtree, so nothing is registered for a
+ * unit until somebody asks for it by path, GetUnit or LoadUnit.  Once
+ * made, an object stays for the lifetime of the process, just like the
+ * unit it stands for.
+ */
+
+typedef struct
+{
+  gchar *name;
+  gchar *path;
+  Unit *unit;
+} UnitObject;
+
+static GDBusInterfaceInfo *unit_interface;
+static GHashTable *unit_objects;
+
+static UnitObject *
+unit_object_get (const gchar  *unit_name,
+                 GError      **error)
+{
+  UnitObject *object;
+  Unit *unit;
+
+  /* Looked up every time, as a drop-in may have remapped or removed
+   * the unit since its object was made.  Objects are kept either way,
+   * since calls in flight point to them.
+   */
+  unit = lookup_unit_by_name (unit_name, error);
+  if (unit == NULL)
+    return NULL;
+
+  object = g_hash_table_lookup (unit_objects, unit_name);
+  if (object)
+    {
+      object->unit = unit;
+      return object;
+    }
+
+  object = g_slice_new (UnitObject);
+  object->name = g_strdup (unit_name);
+  object->path = unit_name_to_path (unit_name);
+  object->unit = unit;
+  g_hash_table_insert (unit_objects, object->name, object);
+
+  return object;
+}
+
+static UnitObject *
+unit_object_get_for_node (const gchar *node)
+{
+  UnitObject *object;
+  gchar *unit_name;
+
+  if (node == NULL || (unit_name = unit_name_from_path_element (node)) == NULL)
+    return NULL;
+
+  object = unit_object_get (unit_name, NULL);
+  g_free (unit_name);
+
+  return object;
+}
+
+static GVariant *
+unit_object_get_property (UnitObject  *object,
+                          const gchar *property_name,
+                          const gchar *state)
+{
+  const gchar *active_state;
+  const gchar *sub_state;
+
+  unit_state_get_active (state, &active_state, &sub_state);
+
+  if (g_str_equal (property_name, "Id") || g_str_equal (property_name, "Description"))
+    return g_variant_new_string (object->name);
+
+  else if (g_str_equal (property_name, "LoadState"))
+    return g_variant_new_string ("loaded");
+
+  else if (g_str_equal (property_name, "ActiveState"))
+    return g_variant_new_string (active_state);
+
+  else if (g_str_equal (property_name, "SubState"))
+    return g_variant_new_string (sub_state);
+
+  else if (g_str_equal (property_name, "UnitFileState"))
+    return g_variant_new_string (state);
+
+  else if (g_str_equal (property_name, "Job"))
+    {
+      Job *job = job_manager_get_unit_job (object->unit);
+
+      if (job)
+        return g_variant_new ("(uo)", job_get_id (job), job_get_path (job));
+
+      return g_variant_new ("(uo)", 0, "/");
+    }
+
+  return NULL;
+}
+
+static void
+unit_object_return_properties (GDBusMethodInvocation *invocation,
+                               const gchar           *state)
+{
+  UnitObject *object = g_dbus_method_invocation_get_user_data (invocation);
+  GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+
+  if (g_str_equal (g_dbus_method_invocation_get_method_name (invocation), "Get"))
+    {
+      const gchar *property_name;
+      GVariant *value;
+
+      /* GDBus has already checked that the property exists */
+      g_variant_get (parameters, "(&s&s)", NULL, &property_name);
+      value = unit_object_get_property (object, property_name, state);
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(v)", value));
+    }
+  else
+    {
+      GVariantBuilder properties;
+      guint i;
+
+      g_variant_builder_init (&properties, G_VARIANT_TYPE ("a{sv}"));
+      for (i = 0; unit_interface->properties[i]; i++)
+        {
+          const gchar *property_name = unit_interface->properties[i]->name;
+
+          g_variant_builder_add (&properties, "{sv}", property_name,
+                                 unit_object_get_property (object, property_name, state));
+        }
+
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(a{sv})", &properties));
+    }
+}
+
+static void
+unit_object_got_state (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  GDBusMethodInvocation *invocation = user_data;
+  GError *error = NULL;
+  const gchar *state;
+
+  state = unit_get_state_finish ((Unit *) source, result, &error);
+
+  if (state)
+    unit_object_return_properties (invocation, state);
+  else
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_error_free (error);
+    }
+
+  shim_release ();
+}
+
+static void
+unit_object_enqueue_job (UnitObject            *object,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation,
+                         JobType                type)
+{
+  const gchar *mode_name;
+  GError *error = NULL;
+  JobMode mode;
+  Job *job;
+
+  g_variant_get (parameters, "(&s)", &mode_name);
+
+  if (!job_mode_from_string (mode_name, &mode, &error) ||
+      !(job = job_enqueue (object->unit, object->name, type, mode, &error)))
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_error_free (error);
+      return;
+    }
+
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job_get_path (job)));
+}
+
+/* There is no get_property in the vtable, so that property reads come
+ * here and can wait for a unit whose state is not cached.  GDBus only
+ * does that from 2.38, hence the version configure asks for.
+ */
+static void
+unit_object_method_call (GDBusConnection       *connection,
+                         const gchar           *sender,
+                         const gchar           *object_path,
+                         const gchar           *interface_name,
+                         const gchar           *method_name,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation,
+                         gpointer               user_data)
+{
+  UnitObject *object = user_data;
+  const gchar *state;
+
+  shim_hold ();
+
+  if (g_str_equal (interface_name, "org.freedesktop.DBus.Properties"))
+    {
+      state = unit_peek_state (object->unit);
+
+      if (state == NULL)
+        {
+          unit_get_state (object->unit, unit_object_got_state, invocation);
+          return;
+        }
+
+      unit_object_return_properties (invocation, state);
+    }
+
+  else if (g_str_equal (method_name, "Start"))
+    unit_object_enqueue_job (object, parameters, invocation, JOB_START);
+
+  else if (g_str_equal (method_name, "Stop"))
+    unit_object_enqueue_job (object, parameters, invocation, JOB_STOP);
+
+  else
+    g_assert_not_reached ();
+
+  shim_release ();
+}
+
+static const GDBusInterfaceVTable unit_object_vtable = {
+  unit_object_method_call,
+  NULL,
+  NULL
+};
+
+/* Only the objects that exist so far are listed.  Calls to any other
+ * valid unit path still get dispatched, and create the object.
+ */
+static gchar **
+unit_objects_enumerate (GDBusConnection *connection,
+                        const gchar     *sender,
+                        const gchar     *object_path,
+                        gpointer         user_data)
+{
+  GHashTableIter iter;
+  UnitObject *object;
+  gchar **nodes;
+  guint i = 0;
+
+  nodes = g_new (gchar *, g_hash_table_size (unit_objects) + 1);
+
+  g_hash_table_iter_init (&iter, unit_objects);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &object))
+    nodes[i++] = g_path_get_basename (object->path);
+  nodes[i] = NULL;
+
+  return nodes;
+}
+
+static GDBusInterfaceInfo **
+unit_objects_introspect (GDBusConnection *connection,
+                         const gchar     *sender,
+                         const gchar     *object_path,
+                         const gchar     *node,
+                         gpointer         user_data)
+{
+  GDBusInterfaceInfo **interfaces;
+
+  if (unit_object_get_for_node (node) == NULL)
+    return NULL;
+
+  interfaces = g_new (GDBusInterfaceInfo *, 2);
+  interfaces[0] = g_dbus_interface_info_ref (unit_interface);
+  interfaces[1] = NULL;
+
+  return interfaces;
+}
+
+static const GDBusInterfaceVTable *
+unit_objects_dispatch (GDBusConnection *connection,
+                       const gchar     *sender,
+                       const gchar     *object_path,
+                       const gchar     *interface_name,
+                       const gchar     *node,
+                       gpointer        *out_user_data,
+                       gpointer         user_data)
+{
+  UnitObject *object;
+
+  object = unit_object_get_for_node (node);
+  if (object == NULL)
+    return NULL;
+
+  *out_user_data = object;
+
+  return &unit_object_vtable;
+}
+
+static const GDBusSubtreeVTable unit_objects_vtable = {
+  unit_objects_enumerate,
+  unit_objects_introspect,
+  unit_objects_dispatch
+};
+
+/* Returns the path of the unit's object, creating it if need be */
+const gchar *
+unit_objects_get_path (const gchar  *unit_name,
+                       GError      **error)
+{
+  UnitObject *object;
+
+  object = unit_object_get (unit_name, error);
+
+  return object ? object->path : NULL;
+}
+
+void
+unit_objects_init (GDBusConnection    *connection,
+                   GDBusInterfaceInfo *unit_iface)
+{
+  unit_interface = unit_iface;
+  unit_objects = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_dbus_connection_register_subtree (connection, "/org/freedesktop/systemd1/unit", &unit_objects_vtable,
+                                      G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+                                      NULL, NULL, NULL);
+}
@@ -18,6 +18,11 @@
  */
 
 #include "unit.h"
+#include "unit-names.h"
+#include "unit-module.h"
+#include "probes.h"
+
+#include <string.h>
 
 G_DEFINE_TYPE (Unit, unit, G_TYPE_OBJECT)
 
@@ -31,29 +36,79 @@ unit_class_init (UnitClass *class)
 {
 }
 
+/* Units are long-lived: each one is created the first time it is looked
+ * up and then kept for the lifetime of the process.
+ */
+static Unit *unit_registry[N_UNIT_IDS];
+
+static Unit *
+unit_registry_get (UnitId id)
+{
+  if (unit_registry[id])
+    return unit_registry[id];
+
+  switch (id)
+    {
+    case UNIT_NTPD:
+      /* Not remembered when NULL: ntp may get installed later on */
+      unit_registry[id] = ntp_unit_get ();
+      break;
+
+    case UNIT_SUSPEND:
+      unit_registry[id] = power_unit_new (POWER_SUSPEND);
+      break;
+
+    case UNIT_HIBERNATE:
+      unit_registry[id] = power_unit_new (POWER_HIBERNATE);
+      break;
+
+    case UNIT_REBOOT:
+      unit_registry[id] = power_unit_new (POWER_REBOOT);
+      break;
+
+    case UNIT_POWEROFF:
+      unit_registry[id] = power_unit_new (POWER_OFF);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  return unit_registry[id];
+}
+
+/* The returned unit belongs to the registry; callers do not unref it. */
 Unit *
 lookup_unit (GVariant  *parameters,
              GError   **error)
 {
   const gchar *unit_name;
-  Unit *unit = NULL;
 
   g_variant_get_child (parameters, 0, "&s", &unit_name);
 
-  if (g_str_equal (unit_name, "ntpd.service"))
-    unit = ntp_unit_get ();
+  return lookup_unit_by_name (unit_name, error);
+}
+
+Unit *
+lookup_unit_by_name (const gchar  *unit_name,
+                     GError      **error)
+{
+  const struct UnitNameEntry *entry;
+  Unit *unit = NULL;
 
-  if (g_str_equal (unit_name, "suspend.target"))
-    unit = power_unit_new (POWER_SUSPEND);
+  SHIM_PROBE1 (lookup__unit__entry, unit_name);
 
-  else if (g_str_equal (unit_name, "hibernate.target"))
-    unit = power_unit_new (POWER_HIBERNATE);
+  entry = unit_name_lookup (unit_name, strlen (unit_name));
 
-  else if (g_str_equal (unit_name, "reboot.target"))
-    unit = power_unit_new (POWER_REBOOT);
+  /* Drop-in mappings are configuration, so they take precedence over
+   * any module that might also claim the name.
+   */
+  if (entry)
+    unit = unit_registry_get (entry->id);
+  else if (!(unit = service_unit_lookup (unit_name)))
+    unit = unit_modules_lookup (unit_name);
 
-  else if (g_str_equal (unit_name, "shutdown.target") || g_str_equal (unit_name, "poweroff.target"))
-    unit = power_unit_new (POWER_OFF);
+  SHIM_PROBE2 (lookup__unit__return, unit_name, unit != NULL);
 
   if (unit == NULL)
     g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FILE_NOT_FOUND,
@@ -62,26 +117,354 @@ lookup_unit (GVariant  *parameters,
   return unit;
 }
 
+typedef struct
+{
+  UnitForeachFunc func;
+  gpointer user_data;
+} UnitForeachData;
+
+static void
+unit_registry_foreach_entry (const struct UnitNameEntry *entry,
+                             void                       *user_data)
+{
+  UnitForeachData *data = user_data;
+  Unit *unit;
+
+  unit = unit_registry_get (entry->id);
+
+  if (unit)
+    data->func (entry->name, unit, data->user_data);
+}
+
+/* Calls func for every name that currently resolves to a unit, so that
+ * aliases are visited once each.  Units that are not available on this
+ * system are skipped, and so are module units nobody has asked for.
+ */
+void
+unit_registry_foreach (UnitForeachFunc func,
+                       gpointer        user_data)
+{
+  UnitForeachData data = { func, user_data };
+
+  unit_name_foreach (unit_registry_foreach_entry, &data);
+  service_unit_foreach (func, user_data);
+  unit_modules_foreach (func, user_data);
+}
+
+/* Object path of the unit, escaped the same way systemd does it: every
+ * byte outside [A-Za-z0-9], and a leading digit, becomes _xx.
+ */
+gchar *
+unit_name_to_path (const gchar *unit_name)
+{
+  GString *path;
+  const gchar *p;
+
+  path = g_string_new ("/org/freedesktop/systemd1/unit/");
+
+  for (p = unit_name; *p; p++)
+    {
+      if (g_ascii_isalpha (*p) || (g_ascii_isdigit (*p) && p != unit_name))
+        g_string_append_c (path, *p);
+      else
+        g_string_append_printf (path, "_%02x", (guchar) *p);
+    }
+
+  return g_string_free (path, FALSE);
+}
+
+/* The inverse of the escaping above, for the last element of a unit
+ * path.  Returns NULL if the element is not validly escaped.
+ */
+gchar *
+unit_name_from_path_element (const gchar *element)
+{
+  GString *name;
+  const gchar *p;
+
+  name = g_string_new (NULL);
+
+  for (p = element; *p; p++)
+    {
+      gint high, low;
+
+      if (*p != '_')
+        {
+          g_string_append_c (name, *p);
+          continue;
+        }
+
+      if ((high = g_ascii_xdigit_value (p[1])) < 0 || (low = g_ascii_xdigit_value (p[2])) < 0)
+        {
+          g_string_free (name, TRUE);
+          return NULL;
+        }
+
+      g_string_append_c (name, (high << 4) | low);
+      p += 2;
+    }
+
+  return g_string_free (name, FALSE);
+}
+
+/* The shim only knows unit file states, so units that are enabled are
+ * reported as running and everything else as dead.
+ */
+void
+unit_state_get_active (const gchar  *state,
+                       const gchar **active_state,
+                       const gchar **sub_state)
+{
+  gboolean active = g_strcmp0 (state, "enabled") == 0;
+
+  *active_state = active ? "active" : "inactive";
+  *sub_state = active ? "running" : "dead";
+}
+
 const gchar *
-unit_get_state (Unit *unit)
+unit_peek_state (Unit *unit)
 {
   g_return_val_if_fail (unit != NULL, NULL);
 
-  return UNIT_GET_CLASS (unit)->get_state (unit);
+  if (UNIT_GET_CLASS (unit)->peek_state == NULL)
+    return NULL;
+
+  return UNIT_GET_CLASS (unit)->peek_state (unit);
+}
+
+void
+unit_get_state (Unit                *unit,
+                GAsyncReadyCallback  callback,
+                gpointer             user_data)
+{
+  g_return_if_fail (unit != NULL);
+
+  UNIT_GET_CLASS (unit)->get_state (unit, g_task_new (unit, NULL, callback, user_data));
+}
+
+const gchar *
+unit_get_state_finish (Unit          *unit,
+                       GAsyncResult  *result,
+                       GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, unit), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 void
-unit_start (Unit *unit)
+unit_start (Unit                *unit,
+            GAsyncReadyCallback  callback,
+            gpointer             user_data)
 {
   g_return_if_fail (unit != NULL);
 
-  return UNIT_GET_CLASS (unit)->start (unit);
+  UNIT_GET_CLASS (unit)->start (unit, g_task_new (unit, NULL, callback, user_data));
+}
+
+gboolean
+unit_start_finish (Unit          *unit,
+                   GAsyncResult  *result,
+                   GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, unit), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 void
-unit_stop (Unit *unit)
+unit_stop (Unit                *unit,
+           GAsyncReadyCallback  callback,
+           gpointer             user_data)
 {
   g_return_if_fail (unit != NULL);
 
-  return UNIT_GET_CLASS (unit)->stop (unit);
+  UNIT_GET_CLASS (unit)->stop (unit, g_task_new (unit, NULL, callback, user_data));
+}
+
+gboolean
+unit_stop_finish (Unit          *unit,
+                  GAsyncResult  *result,
+                  GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, unit), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Batched state queries resolve each distinct unit once, however many
+ * names refer to it, and only ask the units that cannot answer without
+ * I/O.  The result maps each Unit to its unit file state.
+ */
+typedef struct
+{
+  GHashTable *states;
+  guint pending;
+} UnitStatesData;
+
+static void
+unit_states_data_free (gpointer user_data)
+{
+  UnitStatesData *data = user_data;
+
+  g_hash_table_unref (data->states);
+  g_slice_free (UnitStatesData, data);
+}
+
+static void
+unit_states_complete (GTask *task)
+{
+  UnitStatesData *data = g_task_get_task_data (task);
+
+  if (--data->pending == 0)
+    g_task_return_pointer (task, g_hash_table_ref (data->states), (GDestroyNotify) g_hash_table_unref);
+
+  g_object_unref (task);
+}
+
+static void
+unit_states_got_state (GObject      *source,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  GTask *task = user_data;
+  UnitStatesData *data = g_task_get_task_data (task);
+  const gchar *state;
+
+  /* A unit that cannot tell is reported with an empty state, which is
+   * what systemd does for units without a unit file.
+   */
+  state = unit_get_state_finish ((Unit *) source, result, NULL);
+  g_hash_table_replace (data->states, source, (gpointer) (state ? state : ""));
+
+  unit_states_complete (task);
+}
+
+void
+unit_get_states (GPtrArray           *units,
+                 GAsyncReadyCallback  callback,
+                 gpointer             user_data)
+{
+  UnitStatesData *data;
+  GTask *task;
+  guint i;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  data = g_slice_new (UnitStatesData);
+  data->states = g_hash_table_new (g_direct_hash, g_direct_equal);
+  data->pending = 1;
+  g_task_set_task_data (task, data, unit_states_data_free);
+
+  for (i = 0; i < units->len; i++)
+    {
+      Unit *unit = g_ptr_array_index (units, i);
+      const gchar *state;
+
+      if (unit == NULL || g_hash_table_contains (data->states, unit))
+        continue;
+
+      state = unit_peek_state (unit);
+      g_hash_table_insert (data->states, unit, (gpointer) state);
+
+      if (state == NULL)
+        {
+          data->pending++;
+          unit_get_state (unit, unit_states_got_state, g_object_ref (task));
+        }
+    }
+
+  /* Drops the reference held while the queries were being issued */
+  unit_states_complete (task);
+}
+
+GHashTable *
+unit_get_states_finish (GAsyncResult  *result,
+                        GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Blocking work for units runs in a small pool of threads shared by all
+ * units.  Each unit has its own strand: while one of its work items is
+ * in the pool, later ones wait in the unit's queue, so the work of one
+ * unit never overlaps or reorders while different units proceed in
+ * parallel.
+ */
+#define UNIT_STRAND_THREADS 4
+
+typedef struct
+{
+  Unit *unit;
+  GTask *task;
+  GTaskThreadFunc func;
+} UnitStrandItem;
+
+static GThreadPool *unit_strand_pool;
+static GHashTable *unit_strands;
+static GMutex unit_strand_lock;
+
+static void
+unit_strand_run (gpointer data,
+                 gpointer user_data)
+{
+  UnitStrandItem *item = data;
+  UnitStrandItem *next;
+  GQueue *queue;
+
+  item->func (item->task, g_task_get_source_object (item->task),
+              g_task_get_task_data (item->task), g_task_get_cancellable (item->task));
+
+  /* A unit's queue only exists while one of its items is in the pool */
+  g_mutex_lock (&unit_strand_lock);
+  queue = g_hash_table_lookup (unit_strands, item->unit);
+  next = g_queue_pop_head (queue);
+  if (next)
+    g_thread_pool_push (unit_strand_pool, next, NULL);
+  else
+    {
+      g_hash_table_remove (unit_strands, item->unit);
+      g_queue_free (queue);
+    }
+  g_mutex_unlock (&unit_strand_lock);
+
+  g_object_unref (item->task);
+  g_slice_free (UnitStrandItem, item);
+}
+
+void
+unit_run_in_strand (Unit            *unit,
+                    GTask           *task,
+                    GTaskThreadFunc  func)
+{
+  UnitStrandItem *item;
+  GQueue *queue;
+
+  g_return_if_fail (unit != NULL);
+
+  item = g_slice_new (UnitStrandItem);
+  item->unit = unit;
+  item->task = g_object_ref (task);
+  item->func = func;
+
+  g_mutex_lock (&unit_strand_lock);
+
+  if (unit_strand_pool == NULL)
+    {
+      unit_strand_pool = g_thread_pool_new (unit_strand_run, NULL, UNIT_STRAND_THREADS, FALSE, NULL);
+      unit_strands = g_hash_table_new (g_direct_hash, g_direct_equal);
+    }
+
+  queue = g_hash_table_lookup (unit_strands, unit);
+
+  if (queue)
+    g_queue_push_tail (queue, item);
+  else
+    {
+      g_hash_table_insert (unit_strands, unit, g_queue_new ());
+      g_thread_pool_push (unit_strand_pool, item, NULL);
+    }
+
+  g_mutex_unlock (&unit_strand_lock);
 }
@@ -31,16 +31,51 @@ typedef struct
 {
   GObjectClass parent_class;
 
-  const gchar * (* get_state) (Unit *unit);
-  void (* start) (Unit *unit);
-  void (* stop) (Unit *unit);
+  /* Returns the unit file state if it is known without doing any I/O,
+   * or NULL if get_state has to be used.  May be left unset.
+   */
+  const gchar * (* peek_state) (Unit *unit);
+
+  /* Each of these takes ownership of the task and must complete it,
+   * possibly from a later main loop iteration.
+   */
+  void (* get_state) (Unit *unit, GTask *task);
+  void (* start) (Unit *unit, GTask *task);
+  void (* stop) (Unit *unit, GTask *task);
 } UnitClass;
 
 GType unit_get_type (void);
 Unit *lookup_unit (GVariant *parameters, GError **error);
-const gchar *unit_get_state (Unit *unit);
-void unit_start (Unit *unit);
-void unit_stop (Unit *unit);
+Unit *lookup_unit_by_name (const gchar *unit_name, GError **error);
+
+typedef void (* UnitForeachFunc) (const gchar *unit_name, Unit *unit, gpointer user_data);
+void unit_registry_foreach (UnitForeachFunc func, gpointer user_data);
+
+gchar *unit_name_to_path (const gchar *unit_name);
+gchar *unit_name_from_path_element (const gchar *element);
+
+/* Units are exported under /org/freedesktop/systemd1/unit, but only
+ * get an object once a client has asked for one.
+ */
+void unit_objects_init (GDBusConnection *connection, GDBusInterfaceInfo *unit_iface);
+const gchar *unit_objects_get_path (const gchar *unit_name, GError **error);
+void unit_state_get_active (const gchar *state, const gchar **active_state, const gchar **sub_state);
+
+const gchar *unit_peek_state (Unit *unit);
+
+void unit_get_state (Unit *unit, GAsyncReadyCallback callback, gpointer user_data);
+const gchar *unit_get_state_finish (Unit *unit, GAsyncResult *result, GError **error);
+void unit_get_states (GPtrArray *units, GAsyncReadyCallback callback, gpointer user_data);
+GHashTable *unit_get_states_finish (GAsyncResult *result, GError **error);
+
+/* Like g_task_run_in_thread(), but work for the same unit runs one item
+ * at a time, in the order it was submitted.
+ */
+void unit_run_in_strand (Unit *unit, GTask *task, GTaskThreadFunc func);
+void unit_start (Unit *unit, GAsyncReadyCallback callback, gpointer user_data);
+gboolean unit_start_finish (Unit *unit, GAsyncResult *result, GError **error);
+void unit_stop (Unit *unit, GAsyncReadyCallback callback, gpointer user_data);
+gboolean unit_stop_finish (Unit *unit, GAsyncResult *result, GError **error);
 
 Unit *ntp_unit_get (void);
 
@@ -55,4 +90,8 @@ typedef enum
 
 Unit *power_unit_new (PowerAction action);
 
+/* Units mapped by the drop-ins in units.d; see units-index.h */
+Unit *service_unit_lookup (const gchar *unit_name);
+void service_unit_foreach (UnitForeachFunc func, gpointer user_data);
+
 #endif /* _unit_h_ */
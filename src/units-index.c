@@ -0,0 +1,583 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "units-index.h"
+#include "shim.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define UNITS_INDEX_DIR     "/run/systemd-shim"
+#define UNITS_INDEX_FILE    UNITS_INDEX_DIR "/units.index"
+
+#define UNITS_INDEX_MAGIC   "SDSHUNIT"
+#define UNITS_INDEX_VERSION 2
+
+/* What the index was built from: the drop-in directory itself, which
+ * changes when a drop-in is added, removed or renamed, and a hash over
+ * the name, inode, size, mtime and ctime of every drop-in, which
+ * changes when one is rewritten in place.
+ */
+typedef struct
+{
+  guint64 dir_dev;
+  guint64 dir_ino;
+  gint64  dir_mtime_sec;
+  gint64  dir_mtime_nsec;
+  guint64 files_hash;
+} UnitsIndexStamp;
+
+/* The file is laid out as
+ *
+ *   UnitsIndexHeader
+ *   guint32 buckets[n_buckets + 1]
+ *   UnitsIndexEntry entries[n_entries]
+ *   gchar strings[strings_size]
+ *
+ * Entries are sorted by bucket and then by name, and bucket i holds
+ * the entries from buckets[i] up to buckets[i + 1].  Names and jobs
+ * are offsets into the string area.
+ */
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 n_buckets;
+  guint32 n_entries;
+  guint32 strings_size;
+  UnitsIndexStamp stamp;
+} UnitsIndexHeader;
+
+typedef struct
+{
+  guint32 hash;
+  guint32 name;
+  guint32 job;
+  guint32 type;
+} UnitsIndexEntry;
+
+static const gchar * const units_index_type_names[N_UNITS_INDEX_TYPES] = {
+  [UNITS_INDEX_SYSV] = "sysv",
+  [UNITS_INDEX_UPSTART] = "upstart"
+};
+
+static struct
+{
+  gboolean loaded;
+  UnitsIndexStamp stamp;
+  gboolean mapped;
+  const guint8 *data;
+  gsize size;
+  const UnitsIndexHeader *header;
+  const guint32 *buckets;
+  const UnitsIndexEntry *entries;
+  const gchar *strings;
+} units_index;
+
+/* FNV-1a */
+static guint32
+units_index_hash (const gchar *name)
+{
+  guint32 hash = 2166136261u;
+
+  for (; *name; name++)
+    hash = (hash ^ (guchar) *name) * 16777619u;
+
+  return hash;
+}
+
+static gint
+units_index_path_compare (gconstpointer a,
+                          gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Test builds can read drop-ins from a private directory */
+static const gchar *
+units_index_get_source_dir (void)
+{
+#ifdef SHIM_TESTING
+  const gchar *dir;
+
+  dir = g_getenv ("SYSTEMD_SHIM_UNITS_DIR");
+  if (dir)
+    return dir;
+#endif
+
+  return UNITS_INDEX_SOURCE_DIR;
+}
+
+/* The drop-ins, as full paths in the order they are read */
+static GPtrArray *
+units_index_list_drop_ins (void)
+{
+  const gchar *source_dir;
+  const gchar *name;
+  GPtrArray *paths;
+  GDir *dir;
+
+  paths = g_ptr_array_new_with_free_func (g_free);
+  source_dir = units_index_get_source_dir ();
+
+  dir = g_dir_open (source_dir, 0, NULL);
+  if (dir)
+    {
+      while ((name = g_dir_read_name (dir)))
+        if (g_str_has_suffix (name, ".conf"))
+          g_ptr_array_add (paths, g_build_filename (source_dir, name, NULL));
+      g_dir_close (dir);
+    }
+
+  g_ptr_array_sort (paths, units_index_path_compare);
+
+  return paths;
+}
+
+static guint64
+units_index_hash_bytes (guint64       hash,
+                        gconstpointer data,
+                        gsize         size)
+{
+  const guchar *p = data;
+  gsize i;
+
+  /* 64-bit FNV-1a */
+  for (i = 0; i < size; i++)
+    hash = (hash ^ p[i]) * G_GUINT64_CONSTANT (1099511628211);
+
+  return hash;
+}
+
+/* Returns FALSE, with a zeroed stamp, if there is no drop-in directory */
+static gboolean
+units_index_get_stamp (UnitsIndexStamp *stamp)
+{
+  struct stat buf;
+  GPtrArray *paths;
+  guint64 hash;
+  guint i;
+
+  memset (stamp, 0, sizeof *stamp);
+
+  if (stat (units_index_get_source_dir (), &buf) != 0)
+    return FALSE;
+
+  stamp->dir_dev = buf.st_dev;
+  stamp->dir_ino = buf.st_ino;
+  stamp->dir_mtime_sec = buf.st_mtim.tv_sec;
+  stamp->dir_mtime_nsec = buf.st_mtim.tv_nsec;
+
+  hash = G_GUINT64_CONSTANT (14695981039346656037);
+  paths = units_index_list_drop_ins ();
+
+  for (i = 0; i < paths->len; i++)
+    {
+      const gchar *path = g_ptr_array_index (paths, i);
+      gint64 fields[6];
+
+      if (stat (path, &buf) != 0)
+        continue;
+
+      fields[0] = buf.st_ino;
+      fields[1] = buf.st_size;
+      fields[2] = buf.st_mtim.tv_sec;
+      fields[3] = buf.st_mtim.tv_nsec;
+      fields[4] = buf.st_ctim.tv_sec;
+      fields[5] = buf.st_ctim.tv_nsec;
+
+      hash = units_index_hash_bytes (hash, path, strlen (path) + 1);
+      hash = units_index_hash_bytes (hash, fields, sizeof fields);
+    }
+
+  g_ptr_array_unref (paths);
+  stamp->files_hash = hash;
+
+  return TRUE;
+}
+
+typedef struct
+{
+  guint32 bucket;
+  const gchar *name;
+  const gchar *job;
+  UnitsIndexType type;
+} UnitsIndexSource;
+
+static gint
+units_index_source_compare (gconstpointer a,
+                            gconstpointer b)
+{
+  const UnitsIndexSource *sa = a, *sb = b;
+
+  if (sa->bucket != sb->bucket)
+    return sa->bucket < sb->bucket ? -1 : 1;
+
+  return strcmp (sa->name, sb->name);
+}
+
+static void
+units_index_read_drop_in (const gchar *path,
+                          GHashTable  *units)
+{
+  GError *error = NULL;
+  GKeyFile *key_file;
+  gchar **groups;
+  guint i;
+
+  key_file = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error))
+    {
+      g_warning ("Ignoring %s: %s", path, error->message);
+      g_error_free (error);
+      g_key_file_free (key_file);
+      return;
+    }
+
+  groups = g_key_file_get_groups (key_file, NULL);
+
+  for (i = 0; groups[i]; i++)
+    {
+      UnitsIndexSource *source;
+      gchar *job, *type;
+      guint t;
+
+      job = g_key_file_get_string (key_file, groups[i], "Job", NULL);
+      type = g_key_file_get_string (key_file, groups[i], "Type", NULL);
+
+      for (t = 0; type && t < N_UNITS_INDEX_TYPES; t++)
+        if (g_str_equal (type, units_index_type_names[t]))
+          break;
+
+      if (job == NULL || t == N_UNITS_INDEX_TYPES)
+        {
+          g_warning ("Ignoring [%s] in %s: %s", groups[i], path,
+                     job ? "unknown Type" : "no Job given");
+          g_free (job);
+          g_free (type);
+          continue;
+        }
+
+      source = g_slice_new (UnitsIndexSource);
+      source->name = g_strdup (groups[i]);
+      source->job = job;
+      source->type = type ? t : UNITS_INDEX_SYSV;
+      g_free (type);
+
+      g_hash_table_replace (units, (gpointer) source->name, source);
+    }
+
+  g_strfreev (groups);
+  g_key_file_free (key_file);
+}
+
+static void
+units_index_source_free (gpointer data)
+{
+  UnitsIndexSource *source = data;
+
+  g_free ((gchar *) source->name);
+  g_free ((gchar *) source->job);
+  g_slice_free (UnitsIndexSource, source);
+}
+
+/* Parses all the drop-ins and returns the contents of the index file */
+static GBytes *
+units_index_compile (const UnitsIndexStamp *stamp)
+{
+  UnitsIndexHeader header;
+  GHashTableIter iter;
+  UnitsIndexSource *source;
+  GHashTable *units;
+  GPtrArray *names;
+  GArray *sources;
+  GString *strings;
+  GByteArray *out;
+  guint32 *buckets;
+  guint i;
+
+  units = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, units_index_source_free);
+  names = units_index_list_drop_ins ();
+
+  for (i = 0; i < names->len; i++)
+    units_index_read_drop_in (g_ptr_array_index (names, i), units);
+
+  memset (&header, 0, sizeof header);
+  memcpy (header.magic, UNITS_INDEX_MAGIC, sizeof header.magic);
+  header.version = UNITS_INDEX_VERSION;
+  header.n_entries = g_hash_table_size (units);
+  header.n_buckets = 1;
+  while (header.n_buckets < header.n_entries)
+    header.n_buckets <<= 1;
+  header.stamp = *stamp;
+
+  sources = g_array_sized_new (FALSE, FALSE, sizeof (UnitsIndexSource), header.n_entries);
+  g_hash_table_iter_init (&iter, units);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &source))
+    {
+      source->bucket = units_index_hash (source->name) & (header.n_buckets - 1);
+      g_array_append_val (sources, *source);
+    }
+  g_array_sort (sources, units_index_source_compare);
+
+  buckets = g_new0 (guint32, header.n_buckets + 1);
+  strings = g_string_new (NULL);
+  out = g_byte_array_new ();
+  g_byte_array_append (out, (guint8 *) &header, sizeof header);
+  g_byte_array_set_size (out, sizeof header + (header.n_buckets + 1) * sizeof (guint32));
+
+  for (i = 0; i < sources->len; i++)
+    {
+      UnitsIndexSource *s = &g_array_index (sources, UnitsIndexSource, i);
+      UnitsIndexEntry entry;
+
+      buckets[s->bucket + 1] = i + 1;
+
+      entry.hash = units_index_hash (s->name);
+      entry.type = s->type;
+      entry.name = strings->len;
+      g_string_append_len (strings, s->name, strlen (s->name) + 1);
+      entry.job = strings->len;
+      g_string_append_len (strings, s->job, strlen (s->job) + 1);
+
+      g_byte_array_append (out, (guint8 *) &entry, sizeof entry);
+    }
+
+  /* Empty buckets start where the previous one ended */
+  for (i = 1; i <= header.n_buckets; i++)
+    buckets[i] = MAX (buckets[i], buckets[i - 1]);
+  memcpy (out->data + sizeof header, buckets, (header.n_buckets + 1) * sizeof (guint32));
+
+  ((UnitsIndexHeader *) out->data)->strings_size = strings->len;
+  g_byte_array_append (out, (guint8 *) strings->str, strings->len);
+
+  g_free (buckets);
+  g_string_free (strings, TRUE);
+  g_array_unref (sources);
+  g_ptr_array_unref (names);
+  g_hash_table_unref (units);
+
+  return g_byte_array_free_to_bytes (out);
+}
+
+/* Checks that the index is complete and up to date.  The entries are
+ * only checked when they are used, so that a lookup does not have to
+ * touch the whole file.
+ */
+static gboolean
+units_index_attach (const guint8          *data,
+                    gsize                  size,
+                    const UnitsIndexStamp *stamp)
+{
+  const UnitsIndexHeader *header = (const UnitsIndexHeader *) data;
+  gsize tables_size;
+
+  if (size < sizeof *header ||
+      memcmp (header->magic, UNITS_INDEX_MAGIC, sizeof header->magic) != 0 ||
+      header->version != UNITS_INDEX_VERSION)
+    return FALSE;
+
+  if (memcmp (&header->stamp, stamp, sizeof *stamp) != 0)
+    return FALSE;
+
+  tables_size = ((gsize) header->n_buckets + 1) * sizeof (guint32) +
+                (gsize) header->n_entries * sizeof (UnitsIndexEntry);
+
+  if (header->n_buckets == 0 || (header->n_buckets & (header->n_buckets - 1)) ||
+      size != sizeof *header + tables_size + header->strings_size ||
+      (header->strings_size && data[size - 1] != '\0'))
+    return FALSE;
+
+  units_index.data = data;
+  units_index.size = size;
+  units_index.header = header;
+  units_index.buckets = (const guint32 *) (data + sizeof *header);
+  units_index.entries = (const UnitsIndexEntry *) (units_index.buckets + header->n_buckets + 1);
+  units_index.strings = (const gchar *) (units_index.entries + header->n_entries);
+
+  return TRUE;
+}
+
+static gboolean
+units_index_map (const UnitsIndexStamp *stamp)
+{
+  struct stat buf;
+  gpointer map;
+  gint fd;
+
+  fd = open (UNITS_INDEX_FILE, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
+
+  if (fstat (fd, &buf) != 0 || buf.st_size < (off_t) sizeof (UnitsIndexHeader))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  map = mmap (NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return FALSE;
+
+  if (!units_index_attach (map, buf.st_size, stamp))
+    {
+      munmap (map, buf.st_size);
+      return FALSE;
+    }
+
+  units_index.mapped = TRUE;
+
+  return TRUE;
+}
+
+static void
+units_index_unload (void)
+{
+  if (units_index.data)
+    {
+      if (units_index.mapped)
+        munmap ((gpointer) units_index.data, units_index.size);
+      else
+        g_free ((gpointer) units_index.data);
+    }
+
+  memset (&units_index, 0, sizeof units_index);
+}
+
+static void
+units_index_load (void)
+{
+  GError *error = NULL;
+  GBytes *bytes;
+  gpointer data;
+  gsize size;
+
+  units_index.loaded = TRUE;
+
+  /* No drop-ins, nothing to map */
+  if (!units_index_get_stamp (&units_index.stamp))
+    return;
+
+  if (units_index_map (&units_index.stamp))
+    return;
+
+  bytes = units_index_compile (&units_index.stamp);
+
+  /* A dry run uses the index from memory rather than writing it */
+  if (!shim_is_dry_run () &&
+      (g_mkdir_with_parents (UNITS_INDEX_DIR, 0755) != 0 ||
+       !g_file_set_contents (UNITS_INDEX_FILE, g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes), &error)))
+    {
+      g_warning ("Unable to write " UNITS_INDEX_FILE ": %s", error ? error->message : g_strerror (errno));
+      g_clear_error (&error);
+    }
+
+  if (!shim_is_dry_run () && units_index_map (&units_index.stamp))
+    {
+      g_bytes_unref (bytes);
+      return;
+    }
+
+  data = g_bytes_unref_to_data (bytes, &size);
+  if (!units_index_attach (data, size, &units_index.stamp))
+    g_free (data);
+}
+
+static gboolean
+units_index_is_current (void)
+{
+  UnitsIndexStamp stamp;
+
+  units_index_get_stamp (&stamp);
+
+  return memcmp (&stamp, &units_index.stamp, sizeof stamp) == 0;
+}
+
+static const gchar *
+units_index_get_string (guint32 offset)
+{
+  if (offset >= units_index.header->strings_size)
+    return NULL;
+
+  return units_index.strings + offset;
+}
+
+static gboolean
+units_index_find (const gchar     *unit_name,
+                  const gchar    **job,
+                  UnitsIndexType  *type)
+{
+  guint32 hash, bucket, i;
+
+  if (units_index.header == NULL)
+    return FALSE;
+
+  hash = units_index_hash (unit_name);
+  bucket = hash & (units_index.header->n_buckets - 1);
+
+  for (i = units_index.buckets[bucket];
+       i < units_index.buckets[bucket + 1] && i < units_index.header->n_entries;
+       i++)
+    {
+      const UnitsIndexEntry *entry = &units_index.entries[i];
+      const gchar *name;
+
+      if (entry->hash != hash || (name = units_index_get_string (entry->name)) == NULL ||
+          !g_str_equal (name, unit_name))
+        continue;
+
+      *job = units_index_get_string (entry->job);
+      *type = entry->type;
+
+      return *job != NULL && entry->type < N_UNITS_INDEX_TYPES;
+    }
+
+  return FALSE;
+}
+
+/* Returns the job and type that implement unit_name, if any.  The job
+ * string is only valid until the next lookup, which may reload the
+ * index.
+ *
+ * The drop-ins are checked on every lookup, hits included, since a
+ * unit that was found before may have been remapped or removed since.
+ */
+gboolean
+units_index_lookup (const gchar     *unit_name,
+                    const gchar    **job,
+                    UnitsIndexType  *type)
+{
+  if (!units_index.loaded)
+    units_index_load ();
+
+  else if (!units_index_is_current ())
+    {
+      units_index_unload ();
+      units_index_load ();
+    }
+
+  return units_index_find (unit_name, job, type);
+}
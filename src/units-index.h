@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _units_index_h_
+#define _units_index_h_
+
+#include <gio/gio.h>
+
+/* Maps systemd unit names to the sysvinit scripts or upstart jobs that
+ * implement them on this system.  The mapping is configured with
+ * drop-ins in UNITS_INDEX_SOURCE_DIR, e.g. cups.conf:
+ *
+ *   [cups.service]
+ *   Job=cups
+ *   Type=sysv
+ *
+ * Type is "sysv" (the default) or "upstart".  Drop-ins are read in
+ * name order, and later ones override earlier ones for the same unit.
+ *
+ * The drop-ins are compiled into a binary hash index which is mapped
+ * read-only, so that a lookup only touches a few pages and no text has
+ * to be parsed.  The index records the state of the directory and of
+ * every drop-in in it, and is rebuilt when a drop-in is added, removed,
+ * renamed or rewritten in place.  A running shim checks for that on
+ * every lookup, so a unit it has already found can also change or go
+ * away.
+ */
+#define UNITS_INDEX_SOURCE_DIR "/etc/systemd-shim/units.d"
+
+typedef enum
+{
+  UNITS_INDEX_SYSV,
+  UNITS_INDEX_UPSTART,
+  N_UNITS_INDEX_TYPES
+} UnitsIndexType;
+
+gboolean units_index_lookup (const gchar *unit_name, const gchar **job, UnitsIndexType *type);
+
+#endif /* _units_index_h_ */
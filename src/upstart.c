@@ -0,0 +1,497 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#include "upstart.h"
+#include "shim.h"
+
+#include <string.h>
+
+#define UPSTART_ADDRESS             "unix:abstract=/com/ubuntu/upstart"
+#define UPSTART_PATH                "/com/ubuntu/Upstart"
+#define UPSTART_INTERFACE           "com.ubuntu.Upstart0_6"
+#define UPSTART_JOB_INTERFACE       UPSTART_INTERFACE ".Job"
+#define UPSTART_INSTANCE_INTERFACE  UPSTART_INTERFACE ".Instance"
+#define UPSTART_UNKNOWN_INSTANCE    UPSTART_INTERFACE ".Error.UnknownInstance"
+
+/* Upstart talks peer-to-peer on its socket, so there is no bus and the
+ * calls have no destination.
+ */
+typedef void (* UpstartCallFunc) (GTask *task, GDBusConnection *connection);
+
+typedef struct
+{
+  GTask *task;
+  UpstartCallFunc func;
+} UpstartWaiter;
+
+typedef struct
+{
+  gchar *job_path;
+  UpstartJobChangedFunc func;
+  gpointer user_data;
+} UpstartWatch;
+
+static GDBusConnection *upstart_connection;
+static gboolean upstart_connecting;
+static GQueue upstart_waiters = G_QUEUE_INIT;
+static GList *upstart_watches;
+
+static void
+upstart_signal (GDBusConnection *connection,
+                const gchar     *sender_name,
+                const gchar     *object_path,
+                const gchar     *interface_name,
+                const gchar     *signal_name,
+                GVariant        *parameters,
+                gpointer         user_data)
+{
+  GList *node;
+
+  /* Instances live below their job: <job>/<instance> */
+  for (node = upstart_watches; node; node = node->next)
+    {
+      UpstartWatch *watch = node->data;
+      gsize len = strlen (watch->job_path);
+
+      if (strncmp (object_path, watch->job_path, len) == 0 && (object_path[len] == '\0' || object_path[len] == '/'))
+        watch->func (FALSE, watch->user_data);
+    }
+}
+
+static void
+upstart_watch_free (UpstartWatch *watch)
+{
+  g_free (watch->job_path);
+  g_slice_free (UpstartWatch, watch);
+}
+
+static gboolean
+upstart_watch_lost (gpointer user_data)
+{
+  UpstartWatch *watch = user_data;
+
+  watch->func (TRUE, watch->user_data);
+  upstart_watch_free (watch);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+upstart_closed (GDBusConnection *connection,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                gpointer         user_data)
+{
+  GList *watches;
+  GList *node;
+
+  g_clear_object (&upstart_connection);
+
+  /* Tell everybody, so that they look their jobs up again */
+  watches = upstart_watches;
+  upstart_watches = NULL;
+
+  for (node = watches; node; node = node->next)
+    {
+      UpstartWatch *watch = node->data;
+
+      watch->func (TRUE, watch->user_data);
+      upstart_watch_free (watch);
+    }
+
+  g_list_free (watches);
+}
+
+static void
+upstart_connected (GObject      *source,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  UpstartWaiter *waiter;
+  GError *error = NULL;
+
+  upstart_connecting = FALSE;
+  upstart_connection = g_dbus_connection_new_for_address_finish (result, &error);
+
+  if (upstart_connection)
+    {
+      g_dbus_connection_set_exit_on_close (upstart_connection, FALSE);
+      g_signal_connect (upstart_connection, "closed", G_CALLBACK (upstart_closed), NULL);
+      g_dbus_connection_signal_subscribe (upstart_connection, NULL, NULL, NULL, NULL, NULL,
+                                          G_DBUS_SIGNAL_FLAGS_NONE, upstart_signal, NULL, NULL);
+    }
+
+  while ((waiter = g_queue_pop_head (&upstart_waiters)))
+    {
+      if (upstart_connection)
+        waiter->func (waiter->task, upstart_connection);
+      else
+        {
+          g_task_return_error (waiter->task, g_error_copy (error));
+          g_object_unref (waiter->task);
+        }
+
+      g_slice_free (UpstartWaiter, waiter);
+    }
+
+  g_clear_error (&error);
+}
+
+/* Runs func once we are connected, or fails the task if we can't be */
+static void
+upstart_with_connection (GTask           *task,
+                         UpstartCallFunc  func)
+{
+  UpstartWaiter *waiter;
+  const gchar *address;
+
+  if (upstart_connection)
+    {
+      func (task, upstart_connection);
+      return;
+    }
+
+  waiter = g_slice_new (UpstartWaiter);
+  waiter->task = task;
+  waiter->func = func;
+  g_queue_push_tail (&upstart_waiters, waiter);
+
+  if (upstart_connecting)
+    return;
+
+  address = g_getenv ("SYSTEMD_SHIM_UPSTART_ADDRESS");
+  if (address == NULL)
+    address = UPSTART_ADDRESS;
+
+  upstart_connecting = TRUE;
+  g_dbus_connection_new_for_address (address, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                     NULL, NULL, upstart_connected, NULL);
+}
+
+static gboolean
+upstart_error_is (GError      *error,
+                  const gchar *name)
+{
+  gchar *remote;
+  gboolean is;
+
+  remote = g_dbus_error_get_remote_error (error);
+  is = g_strcmp0 (remote, name) == 0;
+  g_free (remote);
+
+  return is;
+}
+
+/* GetJobByName */
+
+static void
+upstart_got_job (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GTask *task = user_data;
+  GVariant *reply;
+  gchar *job_path = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, NULL);
+
+  if (reply)
+    {
+      g_variant_get (reply, "(o)", &job_path);
+      g_variant_unref (reply);
+    }
+
+  g_task_return_pointer (task, job_path, g_free);
+  g_object_unref (task);
+}
+
+static void
+upstart_call_get_job (GTask           *task,
+                      GDBusConnection *connection)
+{
+  g_dbus_connection_call (connection, NULL, UPSTART_PATH, UPSTART_INTERFACE, "GetJobByName",
+                          g_variant_new ("(s)", g_task_get_task_data (task)), G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL, upstart_got_job, task);
+}
+
+void
+upstart_get_job (const gchar         *name,
+                 GAsyncReadyCallback  callback,
+                 gpointer             user_data)
+{
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_task_data (task, g_strdup (name), g_free);
+  upstart_with_connection (task, upstart_call_get_job);
+}
+
+gchar *
+upstart_get_job_finish (GAsyncResult *result)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  /* Not being able to reach upstart is the same as it not having the
+   * job: either way, the caller has to do without.
+   */
+  return g_task_propagate_pointer (G_TASK (result), NULL);
+}
+
+/* GetInstance, then the instance's state */
+
+static void
+upstart_got_instance_state (GObject      *source,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+  GVariant *reply;
+  GVariant *state;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+
+  if (reply == NULL)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  g_variant_get (reply, "(v)", &state);
+  g_task_return_int (task, g_variant_is_of_type (state, G_VARIANT_TYPE_STRING) &&
+                           g_str_equal (g_variant_get_string (state, NULL), "running"));
+  g_variant_unref (state);
+  g_variant_unref (reply);
+  g_object_unref (task);
+}
+
+static void
+upstart_got_instance (GObject      *source,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  GTask *task = user_data;
+  GError *error = NULL;
+  const gchar *instance_path;
+  GVariant *reply;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+
+  if (reply == NULL)
+    {
+      /* No instance means not running */
+      if (upstart_error_is (error, UPSTART_UNKNOWN_INSTANCE))
+        {
+          g_task_return_int (task, FALSE);
+          g_error_free (error);
+        }
+      else
+        g_task_return_error (task, error);
+
+      g_object_unref (task);
+      return;
+    }
+
+  g_variant_get (reply, "(&o)", &instance_path);
+  g_dbus_connection_call (G_DBUS_CONNECTION (source), NULL, instance_path,
+                          "org.freedesktop.DBus.Properties", "Get",
+                          g_variant_new ("(ss)", UPSTART_INSTANCE_INTERFACE, "state"),
+                          G_VARIANT_TYPE ("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          upstart_got_instance_state, task);
+  g_variant_unref (reply);
+}
+
+static void
+upstart_call_get_instance (GTask           *task,
+                           GDBusConnection *connection)
+{
+  g_dbus_connection_call (connection, NULL, g_task_get_task_data (task), UPSTART_JOB_INTERFACE, "GetInstance",
+                          g_variant_new ("(@as)", g_variant_new_strv (NULL, 0)), G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL, upstart_got_instance, task);
+}
+
+void
+upstart_job_get_running (const gchar         *job_path,
+                         GAsyncReadyCallback  callback,
+                         gpointer             user_data)
+{
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_task_data (task, g_strdup (job_path), g_free);
+  upstart_with_connection (task, upstart_call_get_instance);
+}
+
+gboolean
+upstart_job_get_running_finish (GAsyncResult  *result,
+                                gboolean      *running,
+                                GError       **error)
+{
+  GError *local_error = NULL;
+  gssize value;
+
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  value = g_task_propagate_int (G_TASK (result), &local_error);
+
+  if (local_error)
+    {
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+
+  *running = value;
+
+  return TRUE;
+}
+
+/* Start, Stop and Restart */
+
+typedef struct
+{
+  gchar *job_path;
+  UpstartJobAction action;
+} UpstartControl;
+
+static void
+upstart_control_free (gpointer data)
+{
+  UpstartControl *control = data;
+
+  g_free (control->job_path);
+  g_slice_free (UpstartControl, control);
+}
+
+static void upstart_call_control (GTask *task, GDBusConnection *connection);
+
+static void
+upstart_controlled (GObject      *source,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  GTask *task = user_data;
+  UpstartControl *control = g_task_get_task_data (task);
+  GError *error = NULL;
+  GVariant *reply;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+
+  if (reply)
+    {
+      g_variant_unref (reply);
+      g_task_return_boolean (task, TRUE);
+    }
+  else if (upstart_error_is (error, UPSTART_UNKNOWN_INSTANCE) && control->action != UPSTART_JOB_START)
+    {
+      g_error_free (error);
+
+      /* Nothing to stop, or nothing to restart, so start it instead */
+      if (control->action == UPSTART_JOB_RESTART)
+        {
+          control->action = UPSTART_JOB_START;
+          upstart_call_control (task, G_DBUS_CONNECTION (source));
+          return;
+        }
+
+      g_task_return_boolean (task, TRUE);
+    }
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+static void
+upstart_call_control (GTask           *task,
+                      GDBusConnection *connection)
+{
+  static const gchar * const methods[] = {
+    [UPSTART_JOB_START] = "Start",
+    [UPSTART_JOB_STOP] = "Stop",
+    [UPSTART_JOB_RESTART] = "Restart"
+  };
+  UpstartControl *control = g_task_get_task_data (task);
+
+  /* Waits for the job to reach its goal; that can take a while */
+  g_dbus_connection_call (connection, NULL, control->job_path, UPSTART_JOB_INTERFACE, methods[control->action],
+                          g_variant_new ("(@asb)", g_variant_new_strv (NULL, 0), TRUE), NULL,
+                          G_DBUS_CALL_FLAGS_NONE, G_MAXINT, NULL, upstart_controlled, task);
+}
+
+void
+upstart_job_control (const gchar         *job_path,
+                     UpstartJobAction     action,
+                     GAsyncReadyCallback  callback,
+                     gpointer             user_data)
+{
+  UpstartControl *control;
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+
+  if (shim_is_dry_run ())
+    {
+      g_debug ("Not controlling upstart job %s (dry run)", job_path);
+      g_task_return_boolean (task, TRUE);
+      g_object_unref (task);
+      return;
+    }
+
+  control = g_slice_new (UpstartControl);
+  control->job_path = g_strdup (job_path);
+  control->action = action;
+  g_task_set_task_data (task, control, upstart_control_free);
+
+  upstart_with_connection (task, upstart_call_control);
+}
+
+gboolean
+upstart_job_control_finish (GAsyncResult  *result,
+                            GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+void
+upstart_job_watch (const gchar           *job_path,
+                   UpstartJobChangedFunc  func,
+                   gpointer               user_data)
+{
+  UpstartWatch *watch;
+
+  watch = g_slice_new (UpstartWatch);
+  watch->job_path = g_strdup (job_path);
+  watch->func = func;
+  watch->user_data = user_data;
+
+  /* The connection can be lost between looking the job up and getting
+   * here.  Report that from the main loop, just as if it had happened
+   * right after, rather than calling back into the caller from here.
+   */
+  if (upstart_connection == NULL)
+    {
+      g_idle_add (upstart_watch_lost, watch);
+      return;
+    }
+
+  upstart_watches = g_list_prepend (upstart_watches, watch);
+}
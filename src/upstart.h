@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+#ifndef _upstart_h_
+#define _upstart_h_
+
+#include <gio/gio.h>
+
+/* A client for upstart's private D-Bus socket, so that jobs can be
+ * queried and controlled without going through service(8).  The
+ * connection is made on first use.  SYSTEMD_SHIM_UPSTART_ADDRESS
+ * overrides the address, to talk to a private instance instead.
+ */
+
+typedef enum
+{
+  UPSTART_JOB_START,
+  UPSTART_JOB_STOP,
+  UPSTART_JOB_RESTART
+} UpstartJobAction;
+
+/* Resolves to the job's object path, or NULL if upstart is not running
+ * or has no such job.
+ */
+void upstart_get_job (const gchar *name, GAsyncReadyCallback callback, gpointer user_data);
+gchar *upstart_get_job_finish (GAsyncResult *result);
+
+void upstart_job_get_running (const gchar *job_path, GAsyncReadyCallback callback, gpointer user_data);
+gboolean upstart_job_get_running_finish (GAsyncResult *result, gboolean *running, GError **error);
+
+/* Returns once the job has reached its new goal.  Stopping a job that
+ * is not running succeeds, and restarting one starts it.
+ */
+void upstart_job_control (const gchar *job_path, UpstartJobAction action,
+                          GAsyncReadyCallback callback, gpointer user_data);
+gboolean upstart_job_control_finish (GAsyncResult *result, GError **error);
+
+/* func is called whenever an instance of the job comes, goes or changes
+ * state, and once more with connection_lost set if the connection to
+ * upstart goes away, which may already have happened by the time the
+ * watch is added.  After that, the job has to be looked up and watched
+ * again.
+ */
+typedef void (* UpstartJobChangedFunc) (gboolean connection_lost, gpointer user_data);
+
+void upstart_job_watch (const gchar *job_path, UpstartJobChangedFunc func, gpointer user_data);
+
+#endif /* _upstart_h_ */
@@ -25,6 +25,22 @@
 #include <stdio.h>
 #include <string.h>
 
+usec_t now(clockid_t clock_id) {
+        struct timespec ts;
+
+        clock_gettime(clock_id, &ts);
+
+        return timespec_load(&ts);
+}
+
+usec_t timespec_load(const struct timespec *ts) {
+        assert(ts);
+
+        return
+                (usec_t) ts->tv_sec * USEC_PER_SEC +
+                (usec_t) ts->tv_nsec / NSEC_PER_USEC;
+}
+
 int read_one_line_file(const char *fn, char **line) {
         FILE *f;
         int r;
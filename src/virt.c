@@ -20,54 +20,304 @@
 ***/
 
 #include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 
 #include "util.h"
 #include "virt.h"
+#include "probes.h"
+
+/* Detection is driven by tables of signatures.  Every source (a file in
+ * /proc or /sys, or the CPUID vendor string) is read in one go and then
+ * matched against its table in a single pass.  Signatures carry their
+ * length and are rejected on the first byte before anything else is
+ * compared, so a miss costs next to nothing.
+ *
+ * All paths are looked up below a root directory, which is "" for the
+ * running system.  Anything else is a recorded tree (see
+ * bench/virt-fixtures), in which case CPUID and the checks that only
+ * make sense for the live system are skipped. */
+
+typedef struct Signature {
+        const char *text;
+        size_t len;
+        const char *id;
+} Signature;
+
+#define SIGNATURE(text, id) { text, sizeof(text) - 1, id }
+
+/* Prefixes of the DMI vendor strings */
+static const Signature dmi_vendor_table[] = {
+        SIGNATURE("QEMU",                  "qemu"),
+        SIGNATURE("KVM",                   "kvm"),
+        /* http://kb.vmware.com/selfservice/microsites/search.do?language=en_US&cmd=displayKC&externalId=1009458 */
+        SIGNATURE("VMware",                "vmware"),
+        SIGNATURE("VMW",                   "vmware"),
+        SIGNATURE("Microsoft Corporation", "microsoft"),
+        SIGNATURE("innotek GmbH",          "oracle"),
+        SIGNATURE("Xen",                   "xen"),
+        SIGNATURE("Bochs",                 "bochs"),
+        SIGNATURE("Parallels",             "parallels"),
+        SIGNATURE("BHYVE",                 "bhyve"),
+};
+
+/* CPUID leaf 0x40000000 vendor signatures, matched exactly */
+static const Signature cpuid_vendor_table[] = {
+        SIGNATURE("XenVMMXenVMM",          "xen"),
+        SIGNATURE("KVMKVMKVM",             "kvm"),
+        /* http://kb.vmware.com/selfservice/microsites/search.do?language=en_US&cmd=displayKC&externalId=1009458 */
+        SIGNATURE("VMwareVMware",          "vmware"),
+        /* http://msdn.microsoft.com/en-us/library/ff542428.aspx */
+        SIGNATURE("Microsoft Hv",          "microsoft"),
+        SIGNATURE("bhyve bhyve ",          "bhyve"),
+};
+
+/* /sys/hypervisor/type, matched exactly */
+static const Signature hypervisor_type_table[] = {
+        SIGNATURE("xen",                   "xen"),
+};
+
+/* Entries of /proc/device-tree/hypervisor/compatible, matched exactly */
+static const Signature device_tree_table[] = {
+        SIGNATURE("linux,kvm",             "kvm"),
+        SIGNATURE("vmware",                "vmware"),
+};
+
+/* The same entries, matched as prefixes. Xen lists its version too, as
+ * in "xen,xen-4.4", ahead of a plain "xen,xen". */
+static const Signature device_tree_prefix_table[] = {
+        SIGNATURE("xen,",                  "xen"),
+};
+
+/* Values of $container and of /run/systemd/container, matched exactly.
+ * Anything else that is set is reported as "other". */
+static const Signature container_table[] = {
+        SIGNATURE("lxc",                   "lxc"),
+        SIGNATURE("lxc-libvirt",           "lxc-libvirt"),
+        SIGNATURE("systemd-nspawn",        "systemd-nspawn"),
+        SIGNATURE("docker",                "docker"),
+        SIGNATURE("podman",                "podman"),
+        SIGNATURE("rkt",                   "rkt"),
+};
+
+/* Path components in /proc/self/cgroup that container managers use,
+ * matched at every '/' */
+static const Signature cgroup_table[] = {
+        SIGNATURE("/docker/",              "docker"),
+        SIGNATURE("/docker-",              "docker"),
+        SIGNATURE("/lxc/",                 "lxc"),
+        SIGNATURE("/lxc.payload",          "lxc"),
+};
+
+static const char *match_prefix(const Signature *table, size_t n, const char *s, size_t len) {
+        size_t i;
+
+        if (len == 0)
+                return NULL;
+
+        for (i = 0; i < n; i++)
+                if (table[i].text[0] == s[0] &&
+                    table[i].len <= len &&
+                    memcmp(table[i].text, s, table[i].len) == 0)
+                        return table[i].id;
+
+        return NULL;
+}
 
-/* Returns a short identifier for the various VM implementations */
-int detect_vm(const char **id) {
+static const char *match_exact(const Signature *table, size_t n, const char *s, size_t len) {
+        size_t i;
 
-#if defined(__i386__) || defined(__x86_64__)
+        if (len == 0)
+                return NULL;
 
-        /* Both CPUID and DMI are x86 specific interfaces... */
+        for (i = 0; i < n; i++)
+                if (table[i].text[0] == s[0] &&
+                    table[i].len == len &&
+                    memcmp(table[i].text, s, len) == 0)
+                        return table[i].id;
 
-        static const char *const dmi_vendors[] = {
-                "/sys/class/dmi/id/sys_vendor",
-                "/sys/class/dmi/id/board_vendor",
-                "/sys/class/dmi/id/bios_vendor"
-        };
+        return NULL;
+}
+
+#define MATCH_PREFIX(table, s, len) match_prefix(table, ELEMENTSOF(table), s, len)
+#define MATCH_EXACT(table, s, len) match_exact(table, ELEMENTSOF(table), s, len)
+
+static int source_path(const char *root, const char *path, char buf[PATH_MAX]) {
+
+        if (snprintf(buf, PATH_MAX, "%s%s", root, path) >= PATH_MAX)
+                return -ENAMETOOLONG;
+
+        return 0;
+}
+
+static bool source_exists(const char *root, const char *path) {
+        char p[PATH_MAX];
+
+        return source_path(root, path, p) >= 0 && access(p, F_OK) >= 0;
+}
+
+/* Reads a whole file into a NUL-terminated buffer, using as few read()
+ * calls as the file allows. Returns the length, or a negative errno. */
+static ssize_t read_source(const char *root, const char *path, char **ret) {
+        char p[PATH_MAX];
+        size_t size = 4096, len = 0;
+        char *buf = NULL;
+        int fd, r;
+
+        r = source_path(root, path, p);
+        if (r < 0)
+                return r;
+
+        fd = open(p, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        for (;;) {
+                ssize_t n;
+
+                if (!buf || len + 1 >= size) {
+                        char *t;
+
+                        /* Nothing we look at is anywhere near this big */
+                        if (buf && size >= 4*1024*1024) {
+                                r = -EFBIG;
+                                goto fail;
+                        }
+
+                        if (buf)
+                                size *= 2;
+
+                        t = realloc(buf, size);
+                        if (!t) {
+                                r = -ENOMEM;
+                                goto fail;
+                        }
+                        buf = t;
+                }
+
+                n = read(fd, buf + len, size - len - 1);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        goto fail;
+                }
+
+                if (n == 0)
+                        break;
+
+                len += n;
+        }
+
+        close(fd);
+
+        buf[len] = 0;
+        *ret = buf;
 
-        static const char dmi_vendor_table[] =
-                "QEMU\0"                  "qemu\0"
-                /* http://kb.vmware.com/selfservice/microsites/search.do?language=en_US&cmd=displayKC&externalId=1009458 */
-                "VMware\0"                "vmware\0"
-                "VMW\0"                   "vmware\0"
-                "Microsoft Corporation\0" "microsoft\0"
-                "innotek GmbH\0"          "oracle\0"
-                "Xen\0"                   "xen\0"
-                "Bochs\0"                 "bochs\0";
-
-        static const char cpuid_vendor_table[] =
-                "XenVMMXenVMM\0"          "xen\0"
-                "KVMKVMKVM\0"             "kvm\0"
-                /* http://kb.vmware.com/selfservice/microsites/search.do?language=en_US&cmd=displayKC&externalId=1009458 */
-                "VMwareVMware\0"          "vmware\0"
-                /* http://msdn.microsoft.com/en-us/library/ff542428.aspx */
-                "Microsoft Hv\0"          "microsoft\0";
+        return (ssize_t) len;
+
+fail:
+        close(fd);
+        free(buf);
+
+        return r;
+}
+
+/* For single-line files */
+static size_t strip_trailing_whitespace(const char *s, size_t len) {
+
+        while (len > 0 && strchr(WHITESPACE, s[len-1]))
+                len--;
+
+        return len;
+}
+
+/* Finds $container in an environ block in one pass over it. Returns
+ * NULL if it isn't set at all. */
+static const char *match_environ(const char *buf, size_t len) {
+        static const char key[] = "container=";
+        const char *p = buf, *end = buf + len;
+
+        while (p < end) {
+                const char *e;
+
+                e = memchr(p, 0, end - p);
+                if (!e)
+                        e = end;
+
+                if (p[0] == key[0] &&
+                    (size_t) (e - p) >= sizeof(key) - 1 &&
+                    memcmp(p, key, sizeof(key) - 1) == 0) {
+                        const char *found;
+
+                        p += sizeof(key) - 1;
+                        found = MATCH_EXACT(container_table, p, e - p);
+
+                        return found ? found : "other";
+                }
+
+                p = e + 1;
+        }
+
+        return NULL;
+}
+
+static const char *match_cgroup(const char *buf, size_t len) {
+        const char *p = buf, *end = buf + len;
+
+        while ((p = memchr(p, '/', end - p))) {
+                const char *found;
+
+                found = MATCH_PREFIX(cgroup_table, p, end - p);
+                if (found)
+                        return found;
+
+                p++;
+        }
+
+        return NULL;
+}
+
+/* Matches each entry of a NUL-separated device tree string list */
+static const char *match_device_tree(const char *buf, size_t len) {
+        const char *p = buf, *end = buf + len;
+
+        while (p < end) {
+                const char *e, *found;
+
+                e = memchr(p, 0, end - p);
+                if (!e)
+                        e = end;
+
+                found = MATCH_EXACT(device_tree_table, p, e - p) ?:
+                        MATCH_PREFIX(device_tree_prefix_table, p, e - p);
+                if (found)
+                        return found;
+
+                p = e + 1;
+        }
+
+        return NULL;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+/* Returns true if CPUID says there is a hypervisor, and its vendor
+ * signature in sig */
+static bool cpuid_hypervisor(char sig[13]) {
 
         uint32_t eax, ecx;
         union {
                 uint32_t sig32[3];
                 char text[13];
-        } sig;
-        unsigned i;
-        const char *j, *k;
-        bool hypervisor;
+        } s;
 
         /* http://lwn.net/Articles/301888/ */
-        zero(sig);
+        zero(s);
 
 #if defined (__i386__)
 #define REG_a "eax"
@@ -89,204 +339,325 @@ int detect_vm(const char **id) {
                 : "0" (eax)
         );
 
-        hypervisor = !!(ecx & 0x80000000U);
+        if (!(ecx & 0x80000000U))
+                return false;
 
-        if (hypervisor) {
+        /* There is a hypervisor, see what it is */
+        eax = 0x40000000U;
+        __asm__ __volatile__ (
+                /* ebx/rbx is being used for PIC! */
+                "  push %%"REG_b"         \n\t"
+                "  cpuid                  \n\t"
+                "  mov %%ebx, %1          \n\t"
+                "  pop %%"REG_b"          \n\t"
 
-                /* There is a hypervisor, see what it is */
-                eax = 0x40000000U;
-                __asm__ __volatile__ (
-                        /* ebx/rbx is being used for PIC! */
-                        "  push %%"REG_b"         \n\t"
-                        "  cpuid                  \n\t"
-                        "  mov %%ebx, %1          \n\t"
-                        "  pop %%"REG_b"          \n\t"
+                : "=a" (eax), "=r" (s.sig32[0]), "=c" (s.sig32[1]), "=d" (s.sig32[2])
+                : "0" (eax)
+        );
 
-                        : "=a" (eax), "=r" (sig.sig32[0]), "=c" (sig.sig32[1]), "=d" (sig.sig32[2])
-                        : "0" (eax)
-                );
+        memcpy(sig, s.text, 13);
 
-                NULSTR_FOREACH_PAIR(j, k, cpuid_vendor_table)
-                        if (streq(sig.text, j)) {
+        return true;
+}
+#endif
 
-                                if (id)
-                                        *id = k;
+/* Xen's dom0 sees the hypervisor in all the places a guest would, but
+ * runs on the hardware, so like systemd we don't count it as a VM. */
+static bool is_xen_dom0(const char *root) {
+        bool dom0;
+        ssize_t n;
+        char *buf;
 
-                                return 1;
-                        }
+        n = read_source(root, "/proc/xen/capabilities", &buf);
+        if (n < 0)
+                return false;
+
+        dom0 = strstr(buf, "control_d") != NULL;
+        free(buf);
+
+        return dom0;
+}
+
+static int detect_vm_at(const char *root, const char **id) {
+
+        static const char *const dmi_vendors[] = {
+                "/sys/class/dmi/id/sys_vendor",
+                "/sys/class/dmi/id/board_vendor",
+                "/sys/class/dmi/id/bios_vendor"
+        };
+
+        const char *found = NULL;
+        bool hypervisor = false;
+        unsigned i;
+        ssize_t n;
+        char *buf;
+
+#if defined(__i386__) || defined(__x86_64__)
+        if (isempty(root)) {
+                char sig[13];
+
+                hypervisor = cpuid_hypervisor(sig);
+                if (hypervisor)
+                        found = MATCH_EXACT(cpuid_vendor_table, sig, strlen(sig));
+
+                if (found)
+                        goto found;
+        }
+#endif
+
+        /* Xen PV guests don't necessarily show up in CPUID or DMI */
+        n = read_source(root, "/sys/hypervisor/type", &buf);
+        if (n >= 0) {
+                found = MATCH_EXACT(hypervisor_type_table, buf, strip_trailing_whitespace(buf, n));
+                free(buf);
+
+                if (found)
+                        goto found;
         }
 
         for (i = 0; i < ELEMENTSOF(dmi_vendors); i++) {
-                char *s;
-                int r;
-                const char *found = NULL;
 
-                if ((r = read_one_line_file(dmi_vendors[i], &s)) < 0) {
-                        if (r != -ENOENT)
-                                return r;
+                n = read_source(root, dmi_vendors[i], &buf);
+                if (n < 0) {
+                        if (n != -ENOENT)
+                                return (int) n;
 
                         continue;
                 }
 
-                NULSTR_FOREACH_PAIR(j, k, dmi_vendor_table)
-                        if (startswith(s, j))
-                                found = k;
-                free(s);
+                found = MATCH_PREFIX(dmi_vendor_table, buf, n);
+                free(buf);
 
-                if (found) {
-                        if (id)
-                                *id = found;
+                if (found)
+                        goto found;
+        }
 
-                        return 1;
-                }
+        /* Device tree platforms (ARM, POWER) */
+        n = read_source(root, "/proc/device-tree/hypervisor/compatible", &buf);
+        if (n >= 0) {
+                found = match_device_tree(buf, n);
+                free(buf);
+
+                if (found)
+                        goto found;
         }
 
-        if (hypervisor) {
-                if (id)
-                        *id = "other";
+        if (source_exists(root, "/proc/device-tree/ibm,partition-name") &&
+            source_exists(root, "/proc/device-tree/hmc-managed?")) {
+                found = "powervm";
+                goto found;
+        }
 
-                return 1;
+        if (hypervisor) {
+                found = "other";
+                goto found;
         }
 
-#endif
         return 0;
+
+found:
+        if (streq(found, "xen") && is_xen_dom0(root))
+                return 0;
+
+        if (id)
+                *id = found;
+
+        return 1;
 }
 
-int detect_container(const char **id) {
-        FILE *f;
+static int detect_container_at(const char *root, const char **id) {
 
-        /* Unfortunately many of these operations require root access
-         * in one way or another */
+        const char *found = NULL;
+        bool privileged;
+        ssize_t n;
+        char *buf;
 
-        if (geteuid() != 0)
-                return -EPERM;
+        /* Unfortunately some of these checks require root access in one
+         * way or another. Without it we can still find out what the
+         * world readable sources say, but not rule anything out. */
+        privileged = !isempty(root) || geteuid() == 0;
 
-        if (running_in_chroot() > 0) {
+        /* Container managers set this up for exactly this purpose */
+        n = read_source(root, "/run/systemd/container", &buf);
+        if (n >= 0) {
+                size_t len = strip_trailing_whitespace(buf, n);
 
-                if (id)
-                        *id = "chroot";
+                if (len > 0)
+                        found = MATCH_EXACT(container_table, buf, len) ?: "other";
+                free(buf);
+
+                if (found)
+                        goto found;
+        }
 
-                return 1;
+        if (isempty(root) && privileged && running_in_chroot() > 0) {
+                found = "chroot";
+                goto found;
         }
 
         /* /proc/vz exists in container and outside of the container,
          * /proc/bc only outside of the container. */
-        if (access("/proc/vz", F_OK) >= 0 &&
-            access("/proc/bc", F_OK) < 0) {
+        if (source_exists(root, "/proc/vz") &&
+            !source_exists(root, "/proc/bc")) {
+                found = "openvz";
+                goto found;
+        }
 
-                if (id)
-                        *id = "openvz";
+        if (privileged) {
+                n = read_source(root, "/proc/1/environ", &buf);
+                if (n >= 0) {
+                        found = match_environ(buf, n);
+                        free(buf);
 
-                return 1;
+                        if (found)
+                                goto found;
+                }
         }
 
-        f = fopen("/proc/1/environ", "re");
-        if (f) {
-                bool done = false;
+        n = read_source(root, "/proc/self/cgroup", &buf);
+        if (n >= 0) {
+                found = match_cgroup(buf, n);
+                free(buf);
 
-                do {
-                        char line[LINE_MAX];
-                        unsigned i;
+                if (found)
+                        goto found;
+        }
 
-                        for (i = 0; i < sizeof(line)-1; i++) {
-                                int c;
+        return privileged ? 0 : -EPERM;
 
-                                c = getc(f);
-                                if (_unlikely_(c == EOF)) {
-                                        done = true;
-                                        break;
-                                } else if (c == 0)
-                                        break;
+found:
+        if (id)
+                *id = found;
 
-                                line[i] = c;
-                        }
-                        line[i] = 0;
+        return 1;
+}
 
-                        if (streq(line, "container=lxc")) {
-                                fclose(f);
+/* Returns a short identifier for the various VM implementations */
+int detect_vm(const char **id) {
+        return detect_vm_at("", id);
+}
 
-                                if (id)
-                                        *id = "lxc";
-                                return 1;
+int detect_container(const char **id) {
+        return detect_container_at("", id);
+}
 
-                        } else if (streq(line, "container=lxc-libvirt")) {
-                                fclose(f);
+/* Uncached detection, looking at the tree below root instead of the
+ * running system if root is not NULL. For tests and benchmarks. */
+Virtualization detect_virtualization_at(const char *root, const char **id) {
+        int r;
 
-                                if (id)
-                                        *id = "lxc-libvirt";
-                                return 1;
+        if (!root)
+                root = "";
 
-                        } else if (streq(line, "container=systemd-nspawn")) {
-                                fclose(f);
+        r = detect_container_at(root, id);
+        if (r < 0)
+                return r;
+        else if (r > 0)
+                return VIRTUALIZATION_CONTAINER;
 
-                                if (id)
-                                        *id = "systemd-nspawn";
-                                return 1;
+        r = detect_vm_at(root, id);
+        if (r < 0)
+                return r;
+        else if (r > 0)
+                return VIRTUALIZATION_VM;
 
-                        } else if (startswith(line, "container=")) {
-                                fclose(f);
+        return VIRTUALIZATION_NONE;
+}
 
-                                if (id)
-                                        *id = "other";
-                                return 1;
-                        }
+/* The host does not change underneath us, so the result is computed at
+ * most once per process (or restored from the previous instance, see
+ * detect_virtualization_seed()) and then shared by all threads.  The
+ * result is published with a single pointer store; if two threads
+ * race to detect, the first one to publish wins and both return the
+ * same answer. */
+typedef struct VirtualizationResult {
+        Virtualization virt;
+        const char *id;
+} VirtualizationResult;
+
+static VirtualizationResult *cached = NULL;
+
+static const VirtualizationResult *publish_result(Virtualization v, const char *id) {
+        VirtualizationResult *result, *expected = NULL;
+
+        result = new0(VirtualizationResult, 1);
+        if (!result)
+                return NULL;
+
+        result->virt = v;
+        result->id = v > 0 ? id : NULL;
+
+        if (!__atomic_compare_exchange_n(&cached, &expected, result, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                free(result);
+                return expected;
+        }
 
-                } while (!done);
+        return result;
+}
 
-                fclose(f);
-        }
+/* Returns the result of an earlier detection without probing, or
+ * _VIRTUALIZATION_INVALID if there was none yet */
+Virtualization detect_virtualization_cached(const char **id) {
+        const VirtualizationResult *result;
 
-        return 0;
+        result = __atomic_load_n(&cached, __ATOMIC_ACQUIRE);
+        if (!result)
+                return _VIRTUALIZATION_INVALID;
+
+        if (id && result->virt > 0)
+                *id = result->id;
+
+        return result->virt;
 }
 
-/* Returns a short identifier for the various VM/container implementations */
-Virtualization detect_virtualization(const char **id) {
+/* Seeds the cache with a result that is known to be valid for this
+ * boot. id must stay valid for the lifetime of the process. Has no
+ * effect once there is a result. */
+void detect_virtualization_seed(Virtualization v, const char *id) {
 
-        static __thread Virtualization cached_virt = _VIRTUALIZATION_INVALID;
-        static __thread const char *cached_id = NULL;
+        if (v < 0 || v >= _VIRTUALIZATION_MAX)
+                return;
 
-        const char *_id;
-        int r;
-        Virtualization v;
+        if (v > 0 && !id)
+                return;
 
-        if (_likely_(cached_virt >= 0)) {
+        publish_result(v, id);
+}
 
-                if (id && cached_virt > 0)
-                        *id = cached_id;
+/* Returns a short identifier for the various VM/container implementations */
+Virtualization detect_virtualization(const char **id) {
 
-                return cached_virt;
-        }
+        const VirtualizationResult *result;
+        const char *_id = NULL;
+        Virtualization v;
+        usec_t start;
 
-        r = detect_container(&_id);
-        if (r < 0) {
-                v = r;
-                goto finish;
-        } else if (r > 0) {
-                v = VIRTUALIZATION_CONTAINER;
-                goto finish;
-        }
+        v = detect_virtualization_cached(id);
+        if (_likely_(v >= 0))
+                return v;
 
-        r = detect_vm(&_id);
-        if (r < 0) {
-                v = r;
-                goto finish;
-        } else if (r > 0) {
-                v = VIRTUALIZATION_VM;
-                goto finish;
-        }
+        start = now(CLOCK_MONOTONIC);
+        SHIM_PROBE0(virt__detect__entry);
 
-        v = VIRTUALIZATION_NONE;
+        v = detect_virtualization_at(NULL, &_id);
 
-finish:
-        if (v > 0) {
-                cached_id = _id;
+        SHIM_PROBE2(virt__detect__return, v, now(CLOCK_MONOTONIC) - start);
 
-                if (id)
+        /* Errors are not cached, the next caller tries again */
+        if (v < 0)
+                return v;
+
+        result = publish_result(v, _id);
+        if (!result) {
+                if (id && v > 0)
                         *id = _id;
+
+                return v;
         }
 
-        if (v >= 0)
-                cached_virt = v;
+        if (id && result->virt > 0)
+                *id = result->id;
 
-        return v;
+        return result->virt;
 }
@@ -34,5 +34,8 @@ typedef enum Virtualization {
 } Virtualization;
 
 Virtualization detect_virtualization(const char **id);
+Virtualization detect_virtualization_at(const char *root, const char **id);
+Virtualization detect_virtualization_cached(const char **id);
+void detect_virtualization_seed(Virtualization v, const char *id);
 
 #endif
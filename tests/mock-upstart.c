@@ -0,0 +1,343 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* A stand-in for upstart's private D-Bus socket, for make check.
+ *
+ * usage: mock-upstart ADDRESS JOB...
+ *
+ * Serves the parts of com.ubuntu.Upstart0_6 that src/upstart.c uses,
+ * for the given jobs, each of which has at most one instance and starts
+ * out stopped.  Every Job method call is also logged, and the log can
+ * be read back with com.ubuntu.Upstart0_6.Mock.GetCalls on
+ * /com/ubuntu/Upstart.
+ */
+
+#include <gio/gio.h>
+
+#include <stdlib.h>
+
+#define UPSTART_PATH      "/com/ubuntu/Upstart"
+#define UPSTART_JOBS_PATH UPSTART_PATH "/jobs/"
+#define UPSTART_ERROR     "com.ubuntu.Upstart0_6.Error."
+
+static const gchar introspection_xml[] =
+  "<node>"
+  "  <interface name='com.ubuntu.Upstart0_6'>"
+  "    <method name='GetJobByName'>"
+  "      <arg name='name' type='s' direction='in'/>"
+  "      <arg name='job' type='o' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "  <interface name='com.ubuntu.Upstart0_6.Mock'>"
+  "    <method name='GetCalls'>"
+  "      <arg name='calls' type='as' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "  <interface name='com.ubuntu.Upstart0_6.Job'>"
+  "    <method name='GetInstance'>"
+  "      <arg name='env' type='as' direction='in'/>"
+  "      <arg name='instance' type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='Start'>"
+  "      <arg name='env' type='as' direction='in'/>"
+  "      <arg name='wait' type='b' direction='in'/>"
+  "      <arg name='instance' type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='Stop'>"
+  "      <arg name='env' type='as' direction='in'/>"
+  "      <arg name='wait' type='b' direction='in'/>"
+  "    </method>"
+  "    <method name='Restart'>"
+  "      <arg name='env' type='as' direction='in'/>"
+  "      <arg name='wait' type='b' direction='in'/>"
+  "      <arg name='instance' type='o' direction='out'/>"
+  "    </method>"
+  "    <signal name='InstanceAdded'>"
+  "      <arg name='instance' type='o'/>"
+  "    </signal>"
+  "    <signal name='InstanceRemoved'>"
+  "      <arg name='instance' type='o'/>"
+  "    </signal>"
+  "  </interface>"
+  "  <interface name='com.ubuntu.Upstart0_6.Instance'>"
+  "    <property name='state' type='s' access='read'/>"
+  "    <property name='goal' type='s' access='read'/>"
+  "    <signal name='StateChanged'>"
+  "      <arg name='state' type='s'/>"
+  "    </signal>"
+  "  </interface>"
+  "</node>";
+
+typedef struct
+{
+  gchar *name;
+  gchar *path;
+  gchar *instance_path;
+  gboolean running;
+} MockJob;
+
+static GDBusNodeInfo *introspection;
+static GPtrArray *jobs;
+static GPtrArray *connections;
+static GPtrArray *calls;
+
+static MockJob *
+mock_find_job (const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < jobs->len; i++)
+    {
+      MockJob *job = g_ptr_array_index (jobs, i);
+
+      if (g_str_equal (job->name, name))
+        return job;
+    }
+
+  return NULL;
+}
+
+static void
+mock_emit (const gchar *path,
+           const gchar *interface,
+           const gchar *signal,
+           GVariant    *parameters)
+{
+  guint i;
+
+  g_variant_ref_sink (parameters);
+
+  for (i = 0; i < connections->len; i++)
+    g_dbus_connection_emit_signal (g_ptr_array_index (connections, i), NULL, path, interface,
+                                   signal, parameters, NULL);
+
+  g_variant_unref (parameters);
+}
+
+static void
+mock_job_set_running (MockJob  *job,
+                      gboolean  running)
+{
+  job->running = running;
+
+  if (running)
+    {
+      mock_emit (job->path, "com.ubuntu.Upstart0_6.Job", "InstanceAdded",
+                 g_variant_new ("(o)", job->instance_path));
+      mock_emit (job->instance_path, "com.ubuntu.Upstart0_6.Instance", "StateChanged",
+                 g_variant_new ("(s)", "running"));
+    }
+  else
+    {
+      mock_emit (job->instance_path, "com.ubuntu.Upstart0_6.Instance", "StateChanged",
+                 g_variant_new ("(s)", "waiting"));
+      mock_emit (job->path, "com.ubuntu.Upstart0_6.Job", "InstanceRemoved",
+                 g_variant_new ("(o)", job->instance_path));
+    }
+}
+
+static void
+mock_unknown_instance (GDBusMethodInvocation *invocation)
+{
+  g_dbus_method_invocation_return_dbus_error (invocation, UPSTART_ERROR "UnknownInstance",
+                                              "Unknown instance");
+}
+
+static void
+mock_method_call (GDBusConnection       *connection,
+                  const gchar           *sender,
+                  const gchar           *object_path,
+                  const gchar           *interface_name,
+                  const gchar           *method_name,
+                  GVariant              *parameters,
+                  GDBusMethodInvocation *invocation,
+                  gpointer               user_data)
+{
+  MockJob *job = user_data;
+
+  if (g_str_equal (method_name, "GetJobByName"))
+    {
+      const gchar *name;
+
+      g_variant_get (parameters, "(&s)", &name);
+      job = mock_find_job (name);
+
+      if (job)
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job->path));
+      else
+        g_dbus_method_invocation_return_dbus_error (invocation, UPSTART_ERROR "UnknownJob", "Unknown job");
+
+      return;
+    }
+
+  if (g_str_equal (method_name, "GetCalls"))
+    {
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(@as)", g_variant_new_strv ((const gchar * const *) calls->pdata,
+                                                                                         calls->len)));
+      return;
+    }
+
+  g_ptr_array_add (calls, g_strdup_printf ("%s.%s", job->name, method_name));
+
+  if (g_str_equal (method_name, "GetInstance"))
+    {
+      if (job->running)
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job->instance_path));
+      else
+        mock_unknown_instance (invocation);
+    }
+
+  else if (g_str_equal (method_name, "Start"))
+    {
+      if (job->running)
+        g_dbus_method_invocation_return_dbus_error (invocation, UPSTART_ERROR "AlreadyStarted",
+                                                    "Job is already running");
+      else
+        {
+          mock_job_set_running (job, TRUE);
+          g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job->instance_path));
+        }
+    }
+
+  else if (g_str_equal (method_name, "Stop"))
+    {
+      if (job->running)
+        {
+          mock_job_set_running (job, FALSE);
+          g_dbus_method_invocation_return_value (invocation, NULL);
+        }
+      else
+        mock_unknown_instance (invocation);
+    }
+
+  else if (g_str_equal (method_name, "Restart"))
+    {
+      if (job->running)
+        {
+          mock_job_set_running (job, FALSE);
+          mock_job_set_running (job, TRUE);
+          g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", job->instance_path));
+        }
+      else
+        mock_unknown_instance (invocation);
+    }
+}
+
+static GVariant *
+mock_get_property (GDBusConnection  *connection,
+                   const gchar      *sender,
+                   const gchar      *object_path,
+                   const gchar      *interface_name,
+                   const gchar      *property_name,
+                   GError          **error,
+                   gpointer          user_data)
+{
+  MockJob *job = user_data;
+
+  if (g_str_equal (property_name, "goal"))
+    return g_variant_new_string (job->running ? "start" : "stop");
+
+  return g_variant_new_string (job->running ? "running" : "waiting");
+}
+
+static void
+mock_connection_closed (GDBusConnection *connection,
+                        gboolean         remote_peer_vanished,
+                        GError          *error,
+                        gpointer         user_data)
+{
+  g_ptr_array_remove (connections, connection);
+}
+
+static gboolean
+mock_new_connection (GDBusServer     *server,
+                     GDBusConnection *connection,
+                     gpointer         user_data)
+{
+  GDBusInterfaceVTable vtable = { mock_method_call, mock_get_property };
+  guint i;
+
+  g_dbus_connection_register_object (connection, UPSTART_PATH, introspection->interfaces[0],
+                                     &vtable, NULL, NULL, NULL);
+  g_dbus_connection_register_object (connection, UPSTART_PATH, introspection->interfaces[1],
+                                     &vtable, NULL, NULL, NULL);
+
+  for (i = 0; i < jobs->len; i++)
+    {
+      MockJob *job = g_ptr_array_index (jobs, i);
+
+      g_dbus_connection_register_object (connection, job->path, introspection->interfaces[2],
+                                         &vtable, job, NULL, NULL);
+      g_dbus_connection_register_object (connection, job->instance_path, introspection->interfaces[3],
+                                         &vtable, job, NULL, NULL);
+    }
+
+  g_ptr_array_add (connections, g_object_ref (connection));
+  g_signal_connect (connection, "closed", G_CALLBACK (mock_connection_closed), NULL);
+
+  return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  GError *error = NULL;
+  GDBusServer *server;
+  gchar *guid;
+  gint i;
+
+  if (argc < 3)
+    {
+      g_printerr ("usage: %s ADDRESS JOB...\n", argv[0]);
+      return 2;
+    }
+
+  introspection = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+  g_assert (introspection != NULL);
+
+  jobs = g_ptr_array_new ();
+  connections = g_ptr_array_new_with_free_func (g_object_unref);
+  calls = g_ptr_array_new_with_free_func (g_free);
+
+  for (i = 2; i < argc; i++)
+    {
+      MockJob *job = g_new0 (MockJob, 1);
+
+      job->name = argv[i];
+      job->path = g_strconcat (UPSTART_JOBS_PATH, argv[i], NULL);
+      job->instance_path = g_strconcat (job->path, "/_", NULL);
+      g_ptr_array_add (jobs, job);
+    }
+
+  guid = g_dbus_generate_guid ();
+  server = g_dbus_server_new_sync (argv[1], G_DBUS_SERVER_FLAGS_NONE, guid, NULL, NULL, &error);
+  if (server == NULL)
+    {
+      g_printerr ("Unable to listen on %s: %s\n", argv[1], error->message);
+      return 1;
+    }
+
+  g_signal_connect (server, "new-connection", G_CALLBACK (mock_new_connection), NULL);
+  g_dbus_server_start (server);
+
+  g_main_loop_run (g_main_loop_new (NULL, FALSE));
+
+  return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* Checks that the constant replies are shared rather than rebuilt: the
+ * same instance comes back every time, and answering GetUnitFileState
+ * for a unit that knows its state does not allocate.
+ */
+
+#include "shim-replies.h"
+#include "unit.h"
+#include "state.h"
+#include "shim.h"
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef __GLIBC__
+/* Counts the allocations made through malloc() by anything in the
+ * process, including GLib, while counting is switched on.
+ */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t alignment, size_t size);
+
+static volatile gboolean counting;
+static volatile guint n_allocations;
+
+void *
+malloc (size_t size)
+{
+  if (counting)
+    n_allocations++;
+
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n,
+        size_t size)
+{
+  if (counting)
+    n_allocations++;
+
+  return __libc_calloc (n, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+  if (counting)
+    n_allocations++;
+
+  return __libc_realloc (ptr, size);
+}
+
+/* The GSlice allocator may get its chunks this way */
+void *
+memalign (size_t alignment,
+          size_t size)
+{
+  if (counting)
+    n_allocations++;
+
+  return __libc_memalign (alignment, size);
+}
+
+int
+posix_memalign (void   **memptr,
+                size_t   alignment,
+                size_t   size)
+{
+  void *ptr;
+
+  if (counting)
+    n_allocations++;
+
+  if (alignment % sizeof (void *) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+
+  ptr = __libc_memalign (alignment, size);
+  if (ptr == NULL)
+    return ENOMEM;
+
+  *memptr = ptr;
+
+  return 0;
+}
+#endif
+
+/* The units only need this much of the shim */
+gboolean
+shim_is_dry_run (void)
+{
+  return TRUE;
+}
+
+void
+shim_state_save (void)
+{
+}
+
+/* What GetUnitFileState does for a unit that knows its state, up to
+ * handing the reply to GDBus, which takes a reference for the outgoing
+ * message and drops it once the message is gone.
+ */
+static void
+get_unit_file_state (const gchar *unit_name)
+{
+  const gchar *state;
+  GVariant *reply;
+  Unit *unit;
+
+  unit = lookup_unit_by_name (unit_name, NULL);
+  g_assert (unit != NULL);
+
+  state = unit_peek_state (unit);
+  g_assert (state != NULL);
+
+  reply = shim_reply_unit_file_state (state);
+  g_assert (reply != NULL);
+
+  g_variant_unref (g_variant_ref (reply));
+}
+
+static void
+test_unit_file_state_shared (void)
+{
+  static const gchar * const states[] = { "enabled", "disabled", "static" };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (states); i++)
+    {
+      const gchar *state;
+      GVariant *reply;
+
+      reply = shim_reply_unit_file_state (states[i]);
+      g_assert (reply != NULL);
+      g_assert (!g_variant_is_floating (reply));
+      g_assert (g_variant_is_of_type (reply, G_VARIANT_TYPE ("(s)")));
+      g_variant_get (reply, "(&s)", &state);
+      g_assert_cmpstr (state, ==, states[i]);
+      g_assert (shim_reply_unit_file_state (states[i]) == reply);
+    }
+
+  /* Anything else is built per call */
+  g_assert (shim_reply_unit_file_state ("masked") == NULL);
+}
+
+static void
+test_constant_replies_shared (void)
+{
+  g_assert (shim_reply_no_changes () != NULL);
+  g_assert (shim_reply_no_changes () == shim_reply_no_changes ());
+  g_assert (g_variant_is_of_type (shim_reply_no_changes (), G_VARIANT_TYPE ("(a(sss))")));
+  g_assert (!g_variant_is_floating (shim_reply_no_changes ()));
+
+  g_assert (shim_reply_enable () != NULL);
+  g_assert (shim_reply_enable () == shim_reply_enable ());
+  g_assert (g_variant_is_of_type (shim_reply_enable (), G_VARIANT_TYPE ("(ba(sss))")));
+  g_assert (!g_variant_is_floating (shim_reply_enable ()));
+}
+
+static void
+test_no_allocations (void)
+{
+#ifdef __GLIBC__
+  guint i;
+
+  /* The first lookup of each unit creates it */
+  get_unit_file_state ("suspend.target");
+  get_unit_file_state ("hibernate.target");
+
+  n_allocations = 0;
+  counting = TRUE;
+
+  for (i = 0; i < 1000; i++)
+    get_unit_file_state (i % 2 ? "suspend.target" : "hibernate.target");
+
+  counting = FALSE;
+
+  g_assert_cmpuint (n_allocations, ==, 0);
+#else
+  g_test_message ("allocations can only be counted with glibc; skipped");
+#endif
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  shim_replies_init ();
+
+  g_test_add_func ("/replies/unit-file-state-shared", test_unit_file_state_shared);
+  g_test_add_func ("/replies/constant-replies-shared", test_constant_replies_shared);
+  g_test_add_func ("/replies/no-allocations", test_no_allocations);
+
+  return g_test_run ();
+}
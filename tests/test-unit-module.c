@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* A minimal unit module, built only for make check.  It provides
+ * shim-test.service, which is always enabled, and claims
+ * shim-test-missing.service in its manifest without providing it.
+ */
+
+#include "unit-module.h"
+
+#include <gmodule.h>
+
+typedef Unit TestUnit;
+typedef UnitClass TestUnitClass;
+static GType test_unit_get_type (void);
+
+G_DEFINE_TYPE (TestUnit, test_unit, UNIT_TYPE)
+
+G_MODULE_EXPORT const guint32 shim_unit_module_abi = UNIT_MODULE_ABI_VERSION;
+
+static void
+test_unit_complete (Unit  *unit,
+                    GTask *task)
+{
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+static void
+test_unit_get_state (Unit  *unit,
+                     GTask *task)
+{
+  g_task_return_pointer (task, (gpointer) "enabled", NULL);
+  g_object_unref (task);
+}
+
+G_MODULE_EXPORT Unit *
+shim_unit_module_get (const gchar *unit_name)
+{
+  if (g_str_equal (unit_name, "shim-test.service"))
+    return g_object_new (test_unit_get_type (), NULL);
+
+  return NULL;
+}
+
+static void
+test_unit_init (Unit *unit)
+{
+}
+
+static void
+test_unit_class_init (UnitClass *class)
+{
+  class->start = test_unit_complete;
+  class->stop = test_unit_complete;
+  class->get_state = test_unit_get_state;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Loads the test unit module into the shim through its manifest, and
+# checks that the shim serves its unit over a private bus set up like
+# in bench/run-bench.sh.
+#
+# Expects SHIM_TEST, DBUS_DAEMON, GDBUS, srcdir and builddir in the
+# environment; see tests/Makefile.am.
+
+set -e
+
+tmpdir=$(mktemp -d)
+bus_pid=
+trap 'test -n "$bus_pid" && kill $bus_pid; rm -rf "$tmpdir"' EXIT
+
+mkdir "$tmpdir/services" "$tmpdir/units"
+cat > "$tmpdir/services/org.freedesktop.systemd1.service" <<END
+[D-BUS Service]
+Name=org.freedesktop.systemd1
+Exec=$SHIM_TEST
+END
+
+cat > "$tmpdir/bus.conf" <<END
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-BUS Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <listen>unix:path=$tmpdir/bus</listen>
+  <auth>EXTERNAL</auth>
+  <servicedir>$tmpdir/services</servicedir>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*"/>
+    <allow receive_sender="*"/>
+  </policy>
+</busconfig>
+END
+
+cp "$srcdir/test-unit-module.units" "$builddir/test-unit-module.so" "$tmpdir/units/"
+
+DBUS_SYSTEM_BUS_ADDRESS="unix:path=$tmpdir/bus"
+SYSTEMD_SHIM_DRY_RUN=1
+SYSTEMD_SHIM_UNIT_MODULE_DIR="$tmpdir/units"
+export DBUS_SYSTEM_BUS_ADDRESS SYSTEMD_SHIM_DRY_RUN SYSTEMD_SHIM_UNIT_MODULE_DIR
+
+bus_pid=$(${DBUS_DAEMON:-dbus-daemon} --config-file="$tmpdir/bus.conf" --fork --print-pid)
+
+call ()
+{
+  method="$1"
+  shift
+  ${GDBUS:-gdbus} call --system --dest org.freedesktop.systemd1 \
+    --object-path /org/freedesktop/systemd1 \
+    --method "org.freedesktop.systemd1.Manager.$method" "$@" 2>&1
+}
+
+expect ()
+{
+  case "$2" in
+    $3) echo "ok: $1" ;;
+    *) echo "FAIL: $1: got '$2'"; exit 1 ;;
+  esac
+}
+
+expect "module unit state" "$(call GetUnitFileState shim-test.service)" "('enabled',)"
+expect "module unit start" "$(call StartUnit shim-test.service replace)" "(objectpath '/org/freedesktop/systemd1/job/*',)"
+expect "unit claimed but not provided" "$(call GetUnitFileState shim-test-missing.service)" "*Unknown unit*"
+expect "unit not claimed" "$(call GetUnitFileState shim-test-unknown.service)" "*Unknown unit*"
+expect "module unit still served" "$(call GetUnitFileState shim-test.service)" "('enabled',)"
@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Edits a drop-in in place under a running shim, after the units it maps
+# have been looked up, and checks that the shim follows the edit.  Runs
+# on a private bus like test-unit-module.sh.
+#
+# Expects SHIM_TEST, DBUS_DAEMON and GDBUS in the environment; see
+# tests/Makefile.am.
+
+set -e
+
+tmpdir=$(mktemp -d)
+bus_pid=
+trap 'test -n "$bus_pid" && kill $bus_pid; rm -rf "$tmpdir"' EXIT
+
+mkdir "$tmpdir/services" "$tmpdir/units.d"
+cat > "$tmpdir/services/org.freedesktop.systemd1.service" <<END
+[D-BUS Service]
+Name=org.freedesktop.systemd1
+Exec=$SHIM_TEST
+END
+
+cat > "$tmpdir/bus.conf" <<END
+<!DOCTYPE busconfig PUBLIC "-//freedesktop//DTD D-BUS Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <listen>unix:path=$tmpdir/bus</listen>
+  <auth>EXTERNAL</auth>
+  <servicedir>$tmpdir/services</servicedir>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*"/>
+    <allow receive_sender="*"/>
+  </policy>
+</busconfig>
+END
+
+# A job with no rc.d links and no upstart override: disabled as a sysv
+# script, enabled as an upstart job
+drop_in="$tmpdir/units.d/shim-test.conf"
+write_drop_in ()
+{
+  # Rewrites the file in place, keeping its inode
+  cat > "$drop_in" <<END
+[$1]
+Job=shim-test-no-such-job
+Type=$2
+END
+}
+
+write_drop_in shim-test-a.service sysv
+
+DBUS_SYSTEM_BUS_ADDRESS="unix:path=$tmpdir/bus"
+SYSTEMD_SHIM_DRY_RUN=1
+SYSTEMD_SHIM_UNITS_DIR="$tmpdir/units.d"
+export DBUS_SYSTEM_BUS_ADDRESS SYSTEMD_SHIM_DRY_RUN SYSTEMD_SHIM_UNITS_DIR
+
+bus_pid=$(${DBUS_DAEMON:-dbus-daemon} --config-file="$tmpdir/bus.conf" --fork --print-pid)
+
+call ()
+{
+  method="$1"
+  shift
+  ${GDBUS:-gdbus} call --system --dest org.freedesktop.systemd1 \
+    --object-path /org/freedesktop/systemd1 \
+    --method "org.freedesktop.systemd1.Manager.$method" "$@" 2>&1
+}
+
+get_state ()
+{
+  ${GDBUS:-gdbus} call --system --dest org.freedesktop.systemd1 \
+    --object-path "$1" --method org.freedesktop.DBus.Properties.Get \
+    org.freedesktop.systemd1.Unit UnitFileState 2>&1
+}
+
+shim_pid ()
+{
+  ${GDBUS:-gdbus} call --system --dest org.freedesktop.DBus \
+    --object-path /org/freedesktop/DBus \
+    --method org.freedesktop.DBus.GetConnectionUnixProcessID org.freedesktop.systemd1
+}
+
+expect ()
+{
+  case "$2" in
+    $3) echo "ok: $1" ;;
+    *) echo "FAIL: $1: got '$2'"; exit 1 ;;
+  esac
+}
+
+expect "sysv unit state" "$(call GetUnitFileState shim-test-a.service)" "('disabled',)"
+path=$(call GetUnit shim-test-a.service | sed -n "s/^(objectpath '\(.*\)',)$/\1/p")
+expect "unit object" "$path" "/org/freedesktop/systemd1/unit/*"
+expect "unit object state" "$(get_state "$path")" "(<'disabled'>,)"
+pid=$(shim_pid)
+
+write_drop_in shim-test-a.service upstart
+
+expect "remapped unit state" "$(call GetUnitFileState shim-test-a.service)" "('enabled',)"
+expect "remapped unit object state" "$(get_state "$path")" "(<'enabled'>,)"
+
+write_drop_in shim-test-b.service upstart
+
+expect "unit no longer mapped" "$(call GetUnitFileState shim-test-a.service)" "*Unknown unit*"
+expect "unit object no longer mapped" "$(get_state "$path")" "*Error*"
+expect "unit mapped instead" "$(call GetUnitFileState shim-test-b.service)" "('enabled',)"
+
+# Otherwise the shim may only have started afresh
+expect "same shim throughout" "$(shim_pid)" "$pid"
@@ -0,0 +1,346 @@
+/*
+ * Copyright © 2013 Canonical Limited
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the licence, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307,
+ * USA.
+ */
+
+/* Runs the upstart client in src/upstart.c against mock-upstart on a
+ * private socket, found through SYSTEMD_SHIM_UPSTART_ADDRESS as the
+ * shim would.
+ */
+
+#include "upstart.h"
+#include "shim.h"
+
+#include <glib/gstdio.h>
+
+#include <sys/prctl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define JOB_PATH "/com/ubuntu/Upstart/jobs/ntp"
+
+static gboolean dry_run;
+static gchar *address;
+static GPid mock_pid;
+static GAsyncResult *pending_result;
+static guint n_changes;
+static guint n_lost;
+
+/* upstart.c only needs this much of the shim */
+gboolean
+shim_is_dry_run (void)
+{
+  return dry_run;
+}
+
+static void
+got_result (GObject      *source,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+  pending_result = g_object_ref (result);
+}
+
+static GAsyncResult *
+wait_for_result (void)
+{
+  GAsyncResult *result;
+
+  while (pending_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  result = pending_result;
+  pending_result = NULL;
+
+  return result;
+}
+
+/* Iterates until *counter has reached at least value, or fails */
+static void
+wait_for_count (guint *counter,
+                guint  value)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  while (*counter < value && g_get_monotonic_time () < deadline)
+    g_main_context_iteration (NULL, FALSE);
+
+  g_assert_cmpuint (*counter, >=, value);
+}
+
+static gchar *
+get_job (const gchar *name)
+{
+  GAsyncResult *result;
+  gchar *job_path;
+
+  upstart_get_job (name, got_result, NULL);
+  result = wait_for_result ();
+  job_path = upstart_get_job_finish (result);
+  g_object_unref (result);
+
+  return job_path;
+}
+
+static gboolean
+is_running (void)
+{
+  GError *error = NULL;
+  GAsyncResult *result;
+  gboolean running = FALSE;
+
+  upstart_job_get_running (JOB_PATH, got_result, NULL);
+  result = wait_for_result ();
+  g_assert (upstart_job_get_running_finish (result, &running, &error));
+  g_assert_no_error (error);
+  g_object_unref (result);
+
+  return running;
+}
+
+static void
+control (UpstartJobAction action)
+{
+  GError *error = NULL;
+  GAsyncResult *result;
+
+  upstart_job_control (JOB_PATH, action, got_result, NULL);
+  result = wait_for_result ();
+  g_assert (upstart_job_control_finish (result, &error));
+  g_assert_no_error (error);
+  g_object_unref (result);
+}
+
+/* The Job calls the mock has seen so far, joined by spaces */
+static gchar *
+get_calls (void)
+{
+  GDBusConnection *connection;
+  GError *error = NULL;
+  const gchar **calls;
+  GVariant *reply;
+  gchar *joined;
+
+  connection = g_dbus_connection_new_for_address_sync (address, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                       NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  reply = g_dbus_connection_call_sync (connection, NULL, "/com/ubuntu/Upstart", "com.ubuntu.Upstart0_6.Mock",
+                                       "GetCalls", NULL, G_VARIANT_TYPE ("(as)"), G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &error);
+  g_assert_no_error (error);
+
+  g_variant_get (reply, "(^a&s)", &calls);
+  joined = g_strjoinv (" ", (gchar **) calls);
+  g_free (calls);
+  g_variant_unref (reply);
+  g_object_unref (connection);
+
+  return joined;
+}
+
+static void
+assert_calls (const gchar *expected)
+{
+  gchar *calls;
+
+  calls = get_calls ();
+  g_assert_cmpstr (calls, ==, expected);
+  g_free (calls);
+}
+
+static void
+job_changed (gboolean connection_lost,
+             gpointer user_data)
+{
+  if (connection_lost)
+    n_lost++;
+  else
+    n_changes++;
+}
+
+static void
+test_get_job (void)
+{
+  gchar *job_path;
+
+  job_path = get_job ("ntp");
+  g_assert_cmpstr (job_path, ==, JOB_PATH);
+  g_free (job_path);
+
+  /* UnknownJob */
+  g_assert (get_job ("no-such-job") == NULL);
+
+  upstart_job_watch (JOB_PATH, job_changed, NULL);
+}
+
+static void
+test_not_running (void)
+{
+  /* GetInstance fails with UnknownInstance */
+  g_assert (!is_running ());
+  assert_calls ("ntp.GetInstance");
+}
+
+static void
+test_stop_stopped (void)
+{
+  control (UPSTART_JOB_STOP);
+  g_assert (!is_running ());
+  assert_calls ("ntp.GetInstance ntp.Stop ntp.GetInstance");
+  g_assert_cmpuint (n_changes, ==, 0);
+}
+
+static void
+test_restart_stopped (void)
+{
+  /* Nothing to restart, so the client starts the job instead */
+  control (UPSTART_JOB_RESTART);
+  assert_calls ("ntp.GetInstance ntp.Stop ntp.GetInstance ntp.Restart ntp.Start");
+  g_assert (is_running ());
+
+  /* InstanceAdded and StateChanged */
+  wait_for_count (&n_changes, 2);
+}
+
+static void
+test_restart_running (void)
+{
+  guint changes = n_changes;
+
+  control (UPSTART_JOB_RESTART);
+  assert_calls ("ntp.GetInstance ntp.Stop ntp.GetInstance ntp.Restart ntp.Start ntp.GetInstance "
+                "ntp.Restart");
+  g_assert (is_running ());
+  wait_for_count (&n_changes, changes + 4);
+}
+
+static void
+test_stop (void)
+{
+  guint changes = n_changes;
+
+  control (UPSTART_JOB_STOP);
+  g_assert (!is_running ());
+  wait_for_count (&n_changes, changes + 2);
+}
+
+static void
+test_dry_run (void)
+{
+  gchar *before, *after;
+
+  before = get_calls ();
+
+  dry_run = TRUE;
+  control (UPSTART_JOB_START);
+  dry_run = FALSE;
+
+  after = get_calls ();
+  g_assert_cmpstr (before, ==, after);
+  g_free (before);
+  g_free (after);
+
+  g_assert (!is_running ());
+}
+
+static void
+test_connection_lost (void)
+{
+  kill (mock_pid, SIGTERM);
+  g_spawn_close_pid (mock_pid);
+
+  wait_for_count (&n_lost, 1);
+  g_assert_cmpuint (n_lost, ==, 1);
+
+  /* Watching without a connection reports the loss, quietly */
+  upstart_job_watch (JOB_PATH, job_changed, NULL);
+  wait_for_count (&n_lost, 2);
+
+  g_assert (get_job ("ntp") == NULL);
+}
+
+/* Don't leave the mock behind if a test aborts */
+static void
+mock_setup (gpointer user_data)
+{
+  prctl (PR_SET_PDEATHSIG, SIGTERM);
+}
+
+static void
+start_mock (const gchar *tmpdir)
+{
+  GError *error = NULL;
+  const gchar *mock;
+  gchar *socket;
+  gint64 deadline;
+
+  mock = g_getenv ("MOCK_UPSTART");
+  socket = g_build_filename (tmpdir, "upstart", NULL);
+  address = g_strconcat ("unix:path=", socket, NULL);
+
+  {
+    const gchar *argv[] = { mock ? mock : "./mock-upstart", address, "ntp", "other", NULL };
+
+    g_spawn_async (NULL, (gchar **) argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, mock_setup, NULL, &mock_pid, &error);
+    g_assert_no_error (error);
+  }
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  while (!g_file_test (socket, G_FILE_TEST_EXISTS) && g_get_monotonic_time () < deadline)
+    g_usleep (10000);
+
+  g_assert (g_file_test (socket, G_FILE_TEST_EXISTS));
+  g_free (socket);
+
+  g_setenv ("SYSTEMD_SHIM_UPSTART_ADDRESS", address, TRUE);
+}
+
+int
+main (int argc, char **argv)
+{
+  GError *error = NULL;
+  gchar *tmpdir;
+  gchar *socket;
+  gint status;
+
+  g_test_init (&argc, &argv, NULL);
+
+  tmpdir = g_dir_make_tmp ("test-upstart-XXXXXX", &error);
+  g_assert_no_error (error);
+  start_mock (tmpdir);
+
+  g_test_add_func ("/upstart/get-job", test_get_job);
+  g_test_add_func ("/upstart/not-running", test_not_running);
+  g_test_add_func ("/upstart/stop-stopped", test_stop_stopped);
+  g_test_add_func ("/upstart/restart-stopped", test_restart_stopped);
+  g_test_add_func ("/upstart/restart-running", test_restart_running);
+  g_test_add_func ("/upstart/stop", test_stop);
+  g_test_add_func ("/upstart/dry-run", test_dry_run);
+  g_test_add_func ("/upstart/connection-lost", test_connection_lost);
+
+  status = g_test_run ();
+
+  kill (mock_pid, SIGTERM);
+  socket = g_build_filename (tmpdir, "upstart", NULL);
+  g_unlink (socket);
+  g_rmdir (tmpdir);
+  g_free (socket);
+  g_free (tmpdir);
+
+  return status;
+}